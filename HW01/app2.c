@@ -1,36 +1,59 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+
+#define IDLE_MSEC 1000 /* default, stop after this long without items */
 
 int main(int argc, const char *argv[])
 {
-	int item, fd;
+	int item, fd, epfd, idle_msec = IDLE_MSEC, ret;
+	struct epoll_event event = { .events = EPOLLIN };
 	ssize_t bytes_read;
 
-	/* open driver node */
-	fd = open("/dev/stack_device", O_RDONLY);
+	if (argc > 1)
+		idle_msec = atoi(argv[1]);
+
+	/* open driver node, reads of an empty stack would block */
+	fd = open("/dev/stack_device", O_RDONLY | O_NONBLOCK);
 	if (fd < 0) {
-        fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		return -1;
+	}
+
+	/* sleep until items arrive instead of spinning on the device */
+	epfd = epoll_create1(0);
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		fprintf(stderr, "epoll failed err: [%s]\n", strerror(errno));
+		close(fd);
 		return -1;
-    }
+	}
 
-    /* start poping numbers from the driver */
-    while (1) {
+	/* start poping numbers from the driver */
+	while (1) {
 		bytes_read = read(fd, &item, sizeof(item));
 
-		if (bytes_read < 0) /* error */
+		if (bytes_read < 0 && errno == EAGAIN) { /* empty, wait */
+			ret = epoll_wait(epfd, &event, 1, idle_msec);
+			if (ret < 0 && errno != EINTR) {
+				fprintf(stderr, "epoll_wait() failed err: [%s]\n", strerror(errno));
+				break;
+			}
+			if (ret == 0) /* idle, no producer left */
+				break;
+		} else if (bytes_read < 0) /* error */
 			fprintf(stderr, "read() failed err: [%s]\n", strerror(errno));
-		else if (bytes_read == 0) /* EOF */
-			break;
 		else if (bytes_read != sizeof(item)) /* incomplete data */
 			fprintf(stderr, "[NOT READ] %d\n", item);
 		else /* success */
 			fprintf(stdout, "[READ] %d\n", item);
-    }
+	}
 
-    /* cleanup */
+	/* cleanup */
+	close(epfd);
 	close(fd);
 	return 0;
-}
\ No newline at end of file
+}
@@ -1,30 +1,103 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 
+#include "driver/stack_ioctl.h"
+
+#define MAX_ITEMS 4096 /* per push or pop command */
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [command]\n"
+		"  clean             empty the stack (default)\n"
+		"  peek              print top item\n"
+		"  depth             print number of items\n"
+		"  stats             print counters & settings\n"
+		"  push <item> ...   push items, the last one on top\n"
+		"  pop <n>           pop & print up to n items, top first\n", prog);
+}
+
+/* pushes or pops with one ioctl() */
+static int
+batch(int fd, unsigned long cmd, int *items, int nr)
+{
+	struct stack_batch b = {
+		.items = (uintptr_t)items,
+		.nr = nr,
+	};
+
+	if (ioctl(fd, cmd, &b) < 0)
+		return -1;
+	return b.done;
+}
+
 int main(int argc, const char *argv[])
 {
-	int fd, ret;
+	const char *cmd = argc > 1 ? argv[1] : "clean";
+	struct stack_stats stats;
+	int items[MAX_ITEMS];
+	int fd, ret, nr, i;
+	__u32 depth;
 
 	/* open driver node */
 	fd = open("/dev/stack_device", O_RDONLY);
 	if (fd < 0) {
-        fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
 		return -1;
-    }
+	}
 
-    /* call ioctl() on driver */
-    ret = ioctl(fd, 0);
-    if (ret < 0) {
-    	fprintf(stderr, "ioctl() failed err: [%s]\n", strerror(errno));
-    	close(fd);
-    	return -1;
-    }
+	/* call ioctl() on driver */
+	if (strcmp(cmd, "clean") == 0) {
+		ret = ioctl(fd, STACK_IOC_CLEAN);
+	} else if (strcmp(cmd, "peek") == 0) {
+		ret = ioctl(fd, STACK_IOC_PEEK, &items[0]);
+		if (ret == 0)
+			fprintf(stdout, "[TOP] %d\n", items[0]);
+		else if (errno == ENODATA)
+			fprintf(stdout, "[EMPTY]\n");
+	} else if (strcmp(cmd, "depth") == 0) {
+		ret = ioctl(fd, STACK_IOC_GET_DEPTH, &depth);
+		if (ret == 0)
+			fprintf(stdout, "%u\n", depth);
+	} else if (strcmp(cmd, "stats") == 0) {
+		ret = ioctl(fd, STACK_IOC_GET_STATS, &stats);
+		if (ret == 0)
+			fprintf(stdout, "pushes %llu, pops %llu, depth %u, high water %u, "
+				"max depth %u, magazines %u\n",
+				(unsigned long long)stats.pushes, (unsigned long long)stats.pops,
+				stats.depth, stats.high_water, stats.max_depth, stats.magazines);
+	} else if (strcmp(cmd, "push") == 0 && argc > 2 && argc - 2 <= MAX_ITEMS) {
+		for (i = 2; i < argc; i++)
+			items[i - 2] = atoi(argv[i]);
+		ret = batch(fd, STACK_IOC_PUSH_BATCH, items, argc - 2);
+		if (ret >= 0)
+			fprintf(stdout, "[PUSHED] %d of %d\n", ret, argc - 2);
+	} else if (strcmp(cmd, "pop") == 0 && argc == 3) {
+		nr = atoi(argv[2]);
+		if (nr <= 0 || nr > MAX_ITEMS)
+			nr = MAX_ITEMS;
+		ret = batch(fd, STACK_IOC_POP_BATCH, items, nr);
+		for (i = 0; i < ret; i++)
+			fprintf(stdout, "[POPPED] %d\n", items[i]);
+	} else {
+		usage(argv[0]);
+		close(fd);
+		return -1;
+	}
+
+	if (ret < 0 && !(errno == ENODATA && strcmp(cmd, "peek") == 0)) {
+		fprintf(stderr, "ioctl() failed err: [%s]\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
 
-    /* cleanup */
+	/* cleanup */
 	close(fd);
 	return 0;
-}
\ No newline at end of file
+}
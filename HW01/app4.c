@@ -0,0 +1,156 @@
+#define _GNU_SOURCE /* sched_setaffinity() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+
+#define STACK_SIZE 256
+#define ROUNDS 1000 /* default fill & drain rounds */
+
+/* Throughput of single item vs batched read()/write()
+ *
+ * Every round pushes STACK_SIZE items and pops them again, 'batch' items
+ * per system call. Runs once with batch 1, once with the given batch.
+ */
+
+static double
+now_sec(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* returns 1 if the driver logs every call (debug=1), which is
+ * most of what a system call costs then
+ */
+static int
+driver_debug(void)
+{
+	FILE *fp;
+	char value = 'N';
+
+	fp = fopen("/sys/module/stack_device/parameters/debug", "r");
+	if (fp == NULL)
+		return 0;
+	if (fscanf(fp, " %c", &value) != 1)
+		value = 'N';
+	fclose(fp);
+
+	return value == 'Y' || value == '1';
+}
+
+/* returns items moved per second, < 0 on error */
+static double
+run(int fd, int rounds, int batch)
+{
+	int items[STACK_SIZE], round, done, i, nr;
+	ssize_t ret;
+	double start;
+
+	for (i = 0; i < STACK_SIZE; i++)
+		items[i] = i;
+
+	start = now_sec();
+	for (round = 0; round < rounds; round++) {
+		/* fill */
+		for (done = 0; done < STACK_SIZE; done += ret / sizeof(int)) {
+			nr = STACK_SIZE - done < batch ? STACK_SIZE - done : batch;
+			ret = write(fd, items + done, nr * sizeof(int));
+			if (ret <= 0) {
+				fprintf(stderr, "write() failed err: [%s]\n",
+					ret < 0 ? strerror(errno) : "nothing pushed");
+				return -1;
+			}
+		}
+
+		/* drain, top first */
+		for (done = 0; done < STACK_SIZE; done += ret / sizeof(int)) {
+			nr = STACK_SIZE - done < batch ? STACK_SIZE - done : batch;
+			ret = read(fd, items + done, nr * sizeof(int));
+			if (ret <= 0) {
+				fprintf(stderr, "read() failed err: [%s]\n",
+					ret < 0 ? strerror(errno) : "stack empty");
+				return -1;
+			}
+		}
+
+		/* popped in reverse, item i now holds STACK_SIZE - 1 - i */
+		for (i = 0; i < STACK_SIZE; i++) {
+			if (items[i] != STACK_SIZE - 1 - i) {
+				fprintf(stderr, "[WRONG ORDER] %d at %d\n", items[i], i);
+				return -1;
+			}
+			items[i] = i;
+		}
+	}
+
+	return 2.0 * rounds * STACK_SIZE / (now_sec() - start);
+}
+
+int main(int argc, const char *argv[])
+{
+	int fd, cpu, rounds = ROUNDS, batch = STACK_SIZE, items[STACK_SIZE];
+	double single, batched;
+	cpu_set_t cpus;
+
+	if (argc > 1)
+		rounds = atoi(argv[1]);
+	if (argc > 2)
+		batch = atoi(argv[2]);
+	if (rounds <= 0 || batch <= 0 || batch > STACK_SIZE) {
+		fprintf(stderr, "Usage: %s [rounds (default %d)] [batch 1-%d (default %d)]\n",
+			argv[0], ROUNDS, STACK_SIZE, STACK_SIZE);
+		return -1;
+	}
+
+	/* with magazines=1 items sit in per-CPU magazines, pops only
+	 * come back in LIFO order while we stay on one CPU
+	 */
+	cpu = sched_getcpu();
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu < 0 ? 0 : cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+		fprintf(stderr, "sched_setaffinity() failed err: [%s]\n", strerror(errno));
+		return -1;
+	}
+
+	/* open driver node, non-blocking so the drain below ends */
+	fd = open("/dev/stack_device", O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		return -1;
+	}
+
+	if (driver_debug())
+		fprintf(stderr, "warning: driver loaded with debug=1, it logs every call\n");
+
+	/* measurements expect an empty stack */
+	while (read(fd, items, sizeof(items)) > 0)
+		;
+
+	single = run(fd, rounds, 1);
+	if (single < 0)
+		goto error;
+	batched = run(fd, rounds, batch);
+	if (batched < 0)
+		goto error;
+
+	fprintf(stdout, "single  (1 item/call)   : %12.0f items/sec\n", single);
+	fprintf(stdout, "batched (%d items/call) : %12.0f items/sec (%.1fx)\n",
+		batch, batched, batched / single);
+
+	/* cleanup */
+	close(fd);
+	return 0;
+
+error:
+	close(fd);
+	return -1;
+}
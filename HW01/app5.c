@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define STACK_SIZE 256
+#define NR_THREADS 8 /* defaults */
+#define NR_ITEMS 100000 /* per thread */
+#define BATCH 8
+
+/* Stress test of the stack device
+ *
+ * Every thread pushes its own range of items, 'batch' per write(), and
+ * pops 'batch' items after every push, through its own descriptor.
+ * Whatever is left is drained at the end. Every item must be popped
+ * exactly once: none lost, none duplicated, none made up.
+ */
+
+static int nr_threads = NR_THREADS, nr_items = NR_ITEMS, batch = BATCH;
+static int *seen; /* times each item was popped */
+static long long unknown; /* popped items nobody pushed */
+
+static void
+count_popped(const int *items, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (items[i] < 0 || items[i] >= nr_threads * nr_items)
+			__sync_fetch_and_add(&unknown, 1);
+		else
+			__sync_fetch_and_add(&seen[items[i]], 1);
+	}
+}
+
+/* pops up to nr items, returns number popped, < 0 on error */
+static int
+pop(int fd, int *items, int nr)
+{
+	ssize_t ret;
+
+	ret = read(fd, items, nr * sizeof(int));
+	if (ret < 0 && errno == EAGAIN) /* empty */
+		return 0;
+	if (ret < 0) {
+		fprintf(stderr, "read() failed err: [%s]\n", strerror(errno));
+		return -1;
+	}
+	count_popped(items, ret / sizeof(int));
+	return ret / sizeof(int);
+}
+
+static void *
+thread_main(void *arg)
+{
+	int id = (long)arg, fd, first = id * nr_items, done = 0, nr, i;
+	int items[STACK_SIZE];
+	ssize_t ret;
+
+	/* open driver node, non-blocking as every thread pops after pushing */
+	fd = open("/dev/stack_device", O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		return (void *)-1;
+	}
+
+	while (done < nr_items) {
+		nr = nr_items - done < batch ? nr_items - done : batch;
+		for (i = 0; i < nr; i++)
+			items[i] = first + done + i;
+
+		/* a full stack only delays the push, pop below makes room */
+		ret = write(fd, items, nr * sizeof(int));
+		if (ret < 0 && errno != EAGAIN) {
+			fprintf(stderr, "write() failed err: [%s]\n", strerror(errno));
+			goto error;
+		}
+		if (ret > 0)
+			done += ret / sizeof(int);
+
+		if (pop(fd, items, batch) < 0)
+			goto error;
+	}
+
+	/* cleanup */
+	close(fd);
+	return NULL;
+
+error:
+	close(fd);
+	return (void *)-1;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, const char *argv[])
+{
+	pthread_t *threads;
+	int items[STACK_SIZE], fd, i, lost = 0, duplicated = 0, failed = 0;
+	long long total;
+	double start, elapsed;
+	void *ret;
+
+	if (argc > 1)
+		nr_threads = atoi(argv[1]);
+	if (argc > 2)
+		nr_items = atoi(argv[2]);
+	if (argc > 3)
+		batch = atoi(argv[3]);
+	if (nr_threads <= 0 || nr_items <= 0 || batch <= 0 || batch > STACK_SIZE) {
+		fprintf(stderr, "Usage: %s [threads (default %d)] [items per thread "
+			"(default %d)] [batch 1-%d (default %d)]\n", argv[0], NR_THREADS,
+			NR_ITEMS, STACK_SIZE, BATCH);
+		return -1;
+	}
+
+	total = (long long)nr_threads * nr_items;
+	seen = calloc(total, sizeof(int));
+	threads = calloc(nr_threads, sizeof(pthread_t));
+	if (seen == NULL || threads == NULL) {
+		fprintf(stderr, "calloc() failed\n");
+		return -1;
+	}
+
+	fd = open("/dev/stack_device", O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		return -1;
+	}
+
+	/* leftovers of earlier runs are not ours */
+	while (read(fd, items, sizeof(items)) > 0)
+		;
+
+	start = now_sec();
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, thread_main, (void *)(long)i) != 0) {
+			fprintf(stderr, "pthread_create() failed\n");
+			return -1;
+		}
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], &ret);
+		if (ret != NULL)
+			failed = 1;
+	}
+	elapsed = now_sec() - start;
+
+	/* drain */
+	while ((i = pop(fd, items, STACK_SIZE)) > 0)
+		;
+	if (i < 0)
+		failed = 1;
+	close(fd);
+
+	for (i = 0; i < total; i++) {
+		if (seen[i] == 0)
+			lost++;
+		else if (seen[i] > 1)
+			duplicated++;
+	}
+
+	fprintf(stdout, "threads %d, items %lld, batch %d: %.0f items/sec\n",
+		nr_threads, total, batch, 2 * total / elapsed);
+	fprintf(stdout, "lost %d, duplicated %d, unknown %lld\n",
+		lost, duplicated, unknown);
+
+	free(seen);
+	free(threads);
+
+	if (failed || lost || duplicated || unknown) {
+		fprintf(stderr, "[FAILED]\n");
+		return -1;
+	}
+	fprintf(stdout, "[PASSED]\n");
+	return 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "driver/stack_ring.h"
+
+#define NR_THREADS 1 /* defaults */
+#define ROUNDS 10000
+#define BURST 64 /* items pushed, then popped, per round */
+#define MAX_THREADS 64
+
+/* Throughput of the mmap()ed shared stack vs read()/write()
+ *
+ * Every thread pushes BURST items one by one, then pops BURST items,
+ * for a number of rounds; first through read()/write(), then through the
+ * shared stack. A thread finding the stack empty sleeps (blocking read()
+ * or STACK_RING_WAIT) until another one pushes.
+ */
+
+static int nr_threads = NR_THREADS, rounds = ROUNDS;
+static struct stack_ring *ring;
+static int use_ring;
+
+static void *
+thread_main(void *arg)
+{
+	int fd, round, i, item;
+	__u32 seen;
+
+	/* open driver node */
+	fd = open("/dev/stack_device", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		return (void *)-1;
+	}
+
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < BURST; i++) {
+			item = i;
+			if (use_ring && stack_ring_push(ring, fd, item) < 0) {
+				fprintf(stderr, "[FULL] shared stack\n");
+				goto error;
+			} else if (!use_ring && write(fd, &item, sizeof(item)) != sizeof(item)) {
+				fprintf(stderr, "write() failed err: [%s]\n", strerror(errno));
+				goto error;
+			}
+		}
+
+		for (i = 0; i < BURST; i++) {
+			if (!use_ring) {
+				if (read(fd, &item, sizeof(item)) != sizeof(item)) {
+					fprintf(stderr, "read() failed err: [%s]\n", strerror(errno));
+					goto error;
+				}
+				continue;
+			}
+
+			/* empty, sleep until another thread pushes */
+			for (;;) {
+				seen = __atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST);
+				if (stack_ring_pop(ring, fd, &item) == 0)
+					break;
+				if (stack_ring_wait(ring, fd, seen) < 0 && errno != EINTR) {
+					fprintf(stderr, "ioctl() failed err: [%s]\n", strerror(errno));
+					goto error;
+				}
+			}
+		}
+	}
+
+	/* cleanup */
+	close(fd);
+	return NULL;
+
+error:
+	close(fd);
+	return (void *)-1;
+}
+
+/* returns 1 if the driver logs every call (debug=1), read()/write()
+ * would pay a printk each, the shared stack none
+ */
+static int
+driver_debug(void)
+{
+	FILE *fp;
+	char value = 'N';
+
+	fp = fopen("/sys/module/stack_device/parameters/debug", "r");
+	if (fp == NULL)
+		return 0;
+	if (fscanf(fp, " %c", &value) != 1)
+		value = 'N';
+	fclose(fp);
+
+	return value == 'Y' || value == '1';
+}
+
+static double
+now_sec(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* returns push & pop operations per second, < 0 on error */
+static double
+run(void)
+{
+	pthread_t threads[MAX_THREADS];
+	double start;
+	void *ret;
+	int i, failed = 0;
+
+	start = now_sec();
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, thread_main, NULL) != 0) {
+			fprintf(stderr, "pthread_create() failed\n");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], &ret);
+		if (ret != NULL)
+			failed = 1;
+	}
+
+	return failed ? -1 : 2.0 * nr_threads * rounds * BURST / (now_sec() - start);
+}
+
+int main(int argc, const char *argv[])
+{
+	double rw, shared;
+	__u32 capacity;
+	int fd;
+
+	if (argc > 1)
+		nr_threads = atoi(argv[1]);
+	if (argc > 2)
+		rounds = atoi(argv[2]);
+	if (nr_threads <= 0 || nr_threads > MAX_THREADS || rounds <= 0) {
+		fprintf(stderr, "Usage: %s [threads 1-%d (default %d)] [rounds (default %d)]\n",
+			argv[0], MAX_THREADS, NR_THREADS, ROUNDS);
+		return -1;
+	}
+
+	fd = open("/dev/stack_device", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "open() failed err: [%s]\n", strerror(errno));
+		return -1;
+	}
+
+	if (driver_debug())
+		fprintf(stderr, "warning: driver loaded with debug=1, read/write numbers include a printk per call\n");
+
+	/* the first page holds the header & capacity */
+	ring = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		fprintf(stderr, "mmap() failed err: [%s]\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	capacity = ring->capacity;
+	if (ring->top != 0 || capacity < (__u32)nr_threads * BURST) {
+		fprintf(stderr, "shared stack holds %u items, room for %u\n",
+			ring->top, capacity);
+		goto error;
+	}
+	if (munmap(ring, getpagesize()) < 0)
+		goto error;
+	ring = mmap(NULL, sizeof(*ring) + capacity * sizeof(int),
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		fprintf(stderr, "mmap() failed err: [%s]\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	use_ring = 0;
+	rw = run();
+	if (rw < 0)
+		goto error;
+	use_ring = 1;
+	shared = run();
+	if (shared < 0)
+		goto error;
+
+	fprintf(stdout, "threads %d, %d items per burst\n", nr_threads, BURST);
+	fprintf(stdout, "read/write    : %12.0f ops/sec\n", rw);
+	fprintf(stdout, "shared stack  : %12.0f ops/sec (%.1fx)\n", shared, shared / rw);
+
+	/* cleanup */
+	close(fd);
+	return 0;
+
+error:
+	close(fd);
+	return -1;
+}
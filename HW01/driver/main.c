@@ -1,4 +1,6 @@
 #include "stack.h"
+#include "stack_ioctl.h"
+#include "ring.h"
 #include "utils.h"
 
 #include <linux/module.h>
@@ -6,10 +8,35 @@
 #include <linux/cdev.h>
 #include <linux/uaccess.h>
 #include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/err.h>
 
 #define CHARDEV_NAME "stack_device" /* device name */
 #define CHARDEV_NR_MINOR 0 /* starting minor number */
-#define CHARDEV_NR_DEVICES 1 /* number of devices (only 1 is supported) */
+#define CHARDEV_NR_DEVICES 1 /* default number of devices */
+#define MAX_DEVICES 256
+#define MAX_BATCH 256 /* items moved by one read() or write() */
+
+/* A stack & the tasks sleeping on it
+ * Each minor has one, shared by everyone opening it; with
+ * private_stacks=1 each open() gets its own instead.
+ */
+struct stack_dev {
+	struct stack *st;
+	wait_queue_head_t read_wq; /* readers waiting for items */
+	wait_queue_head_t write_wq; /* writers waiting for room */
+	struct ring *ring; /* shared stack of the minor */
+};
+
+/* /dev/stack_device, /dev/stack_device1, ... */
+struct stack_minor {
+	struct stack_dev dev;
+	struct ring ring;
+	struct device *device; /* device node */
+};
 
 /* dynamically allocated device number */
 static dev_t dev_first = 0;
@@ -20,79 +47,328 @@ static struct cdev *cdev = NULL;
 /* device class */
 static struct class *class = NULL;
 
-/* device node */
-struct device *device = NULL;
+/* nr_devices minors */
+static struct stack_minor *minors = NULL;
+
+static int nr_devices = CHARDEV_NR_DEVICES;
+module_param(nr_devices, int, 0444);
+MODULE_PARM_DESC(nr_devices, "number of independent stack devices (default 1, at most 256)");
 
+static bool private_stacks;
+module_param(private_stacks, bool, 0444);
+MODULE_PARM_DESC(private_stacks, "give every open() its own stack (default 0, one stack per device)");
+
+/* dbg() sits on every read/write/ioctl, a printk each would dominate the benchmarks */
+bool stack_debug;
+module_param_named(debug, stack_debug, bool, 0644);
+MODULE_PARM_DESC(debug, "log every call with KERN_DEBUG (default 0)");
+
+/* returns -ENOMEM if out of memory */
+static int
+stack_dev_setup(struct stack_dev *dev, struct ring *ring)
+{
+	dev->st = st_create();
+	if (dev->st == NULL)
+		return -ENOMEM;
+
+	init_waitqueue_head(&dev->read_wq);
+	init_waitqueue_head(&dev->write_wq);
+	dev->ring = ring;
+	return 0;
+}
+
+/* file->private_data is the minor's stack, or a private one */
 static int
 stack_dev_open(struct inode *inode, struct file *file)
 {
-	dbg("");
+	struct stack_minor *minor = &minors[iminor(inode) - MINOR(dev_first)];
+	struct stack_dev *dev;
+
+	dbg("%u", iminor(inode));
+
+	if (!private_stacks) {
+		file->private_data = &minor->dev;
+		return 0;
+	}
+
+	dev = kmalloc(sizeof(*dev), GFP_KERNEL);
+	if (dev == NULL)
+		return -ENOMEM;
+	if (stack_dev_setup(dev, &minor->ring) < 0) {
+		kfree(dev);
+		return -ENOMEM;
+	}
+
+	file->private_data = dev;
 	return 0;
 }
 
+/* items a read()/write() of length bytes moves, trailing bytes are ignored */
+static int
+batch_items(size_t length)
+{
+	if (length / sizeof(int) > MAX_BATCH)
+		return MAX_BATCH;
+	return length / sizeof(int);
+}
+
+/* pops up to nr items, waits for at least one unless O_NONBLOCK */
+static int
+pop_wait(struct file *file, int *items, int nr)
+{
+	struct stack_dev *dev = file->private_data;
+	int ret;
+
+	if (file->f_flags & O_NONBLOCK) {
+		ret = st_pop_many(dev->st, items, nr);
+		return ret == 0 ? -EAGAIN : ret;
+	}
+
+	/* woken by pushes, another reader may get there first */
+	if (wait_event_interruptible(dev->read_wq,
+		(ret = st_pop_many(dev->st, items, nr)) != 0))
+		return -ERESTARTSYS;
+	return ret;
+}
+
+/* pushes up to nr items, waits for room for one unless O_NONBLOCK */
+static int
+push_wait(struct file *file, const int *items, int nr)
+{
+	struct stack_dev *dev = file->private_data;
+	int ret;
+
+	if (file->f_flags & O_NONBLOCK) {
+		ret = st_push_many(dev->st, items, nr);
+		return ret == 0 ? -EAGAIN : ret;
+	}
+
+	/* woken by pops & clean, another writer may get there first */
+	if (wait_event_interruptible(dev->write_wq,
+		(ret = st_push_many(dev->st, items, nr)) != 0))
+		return -ERESTARTSYS;
+	return ret;
+}
+
+/* pops up to length / sizeof(int) items, top of stack first
+ * Blocks while the stack is empty, -EAGAIN with O_NONBLOCK.
+ */
 static ssize_t
 stack_dev_read(struct file *file, char __user *buffer, size_t length, loff_t *offset)
 {
-	int item, ret;
+	struct stack_dev *dev = file->private_data;
+	int *items, nr, ret;
 
 	dbg("");
 
-	/* EOF, return 0 */
-	if (st_is_empty())
-		return 0;
+	/* not even one item fits */
+	nr = batch_items(length);
+	if (nr == 0)
+		return -EINVAL;
+
+	items = kmalloc(nr * sizeof(int), GFP_KERNEL);
+	if (items == NULL)
+		return -ENOMEM;
 
 	/* pop */
-	ret = st_pop(&item);
+	ret = pop_wait(file, items, nr);
 	if (ret < 0)
-		return ret;
+		goto out;
+	wake_up_interruptible(&dev->write_wq);
 
-	/* copy data into user space */
-	if (copy_to_user(buffer, &item, sizeof(item)))
-		return -EFAULT; /* Bad address */
+	/* copy data into user space, all items at once */
+	if (copy_to_user(buffer, items, ret * sizeof(int))) {
+		ret = -EFAULT; /* Bad address */
+		goto out;
+	}
 
 	/* popped & copied to user space, return bytes */
-	return sizeof(item);
+	ret *= sizeof(int);
+out:
+	kfree(items);
+	return ret;
 }
 
+/* pushes up to length / sizeof(int) items, the last one ends up on top
+ * Pushes as many as fit, returning fewer bytes than length. Blocks while
+ * the stack is full, -EAGAIN with O_NONBLOCK.
+ */
 static ssize_t
 stack_dev_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset)
 {
-	int item, ret;
+	struct stack_dev *dev = file->private_data;
+	int *items, nr, ret;
 
 	dbg("");
 
-	/* No more space */
-	if (st_is_full())
+	/* not even one item given */
+	nr = batch_items(length);
+	if (nr == 0)
+		return -EINVAL;
+
+	items = kmalloc(nr * sizeof(int), GFP_KERNEL);
+	if (items == NULL)
 		return -ENOMEM;
 
-	/* copy data from user space */
-	if (copy_from_user(&item, buffer, sizeof(item)))
-		return -EFAULT; /* Bad address */
+	/* copy data from user space, all items at once */
+	if (copy_from_user(items, buffer, nr * sizeof(int))) {
+		ret = -EFAULT; /* Bad address */
+		goto out;
+	}
 
 	/* push */
-	ret = st_push(item);
+	ret = push_wait(file, items, nr);
 	if (ret < 0)
-		return ret;
+		goto out;
+	wake_up_interruptible(&dev->read_wq);
 
 	/* pushed & copied from user space, return bytes */
-	return sizeof(item);
+	ret *= sizeof(int);
+out:
+	kfree(items);
+	return ret;
 }
 
+/* frees a private stack, nobody else can reach it */
 static int
 stack_dev_release(struct inode *inode, struct file *file)
 {
+	struct stack_dev *dev = file->private_data;
+
 	dbg("");
+
+	if (private_stacks) {
+		st_destroy(dev->st);
+		kfree(dev);
+	}
 	return 0;
 }
 
+/* STACK_IOC_PUSH_BATCH & STACK_IOC_POP_BATCH
+ * Moves MAX_BATCH items at a time through a kernel buffer, stops at a
+ * full or empty stack instead of blocking. Fails only if no item moved.
+ */
+static long
+ioctl_batch(struct stack_dev *dev, unsigned int cmd, struct stack_batch __user *ubatch)
+{
+	struct stack_batch batch;
+	int __user *uitems;
+	int *items, nr, ret = 0;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT; /* Bad address */
+	uitems = (int __user *)(uintptr_t)batch.items;
+
+	items = kmalloc(MAX_BATCH * sizeof(int), GFP_KERNEL);
+	if (items == NULL)
+		return -ENOMEM;
+
+	for (batch.done = 0; batch.done < batch.nr; batch.done += ret) {
+		nr = min_t(__u32, batch.nr - batch.done, MAX_BATCH);
+		if (cmd == STACK_IOC_PUSH_BATCH) {
+			if (copy_from_user(items, uitems + batch.done, nr * sizeof(int))) {
+				ret = -EFAULT;
+				break;
+			}
+			ret = st_push_many(dev->st, items, nr);
+		} else {
+			ret = st_pop_many(dev->st, items, nr);
+			if (ret > 0 &&
+				copy_to_user(uitems + batch.done, items, ret * sizeof(int))) {
+				ret = -EFAULT;
+				break;
+			}
+		}
+
+		/* full, empty or failed */
+		if (ret <= 0)
+			break;
+		if (ret < nr) {
+			batch.done += ret;
+			break;
+		}
+	}
+	kfree(items);
+
+	if (batch.done > 0)
+		wake_up_interruptible(cmd == STACK_IOC_PUSH_BATCH ?
+			&dev->read_wq : &dev->write_wq);
+	else if (ret < 0)
+		return ret;
+
+	if (put_user(batch.done, &ubatch->done))
+		return -EFAULT;
+	return 0;
+}
+
+/* commands of stack_ioctl.h, unknown ones fail with -ENOTTY */
 static long
 stack_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	struct stack_dev *dev = file->private_data;
+	struct stack_stats stats;
+	int item, ret;
+
+	dbg("%u", cmd);
+
+	switch (cmd) {
+	case STACK_IOC_CLEAN:
+		st_clean(dev->st);
+
+		/* room for blocked writers */
+		wake_up_interruptible(&dev->write_wq);
+		return 0;
+	case STACK_IOC_PEEK:
+		ret = st_peek(dev->st, &item);
+		if (ret < 0)
+			return ret;
+		return put_user(item, (int __user *)arg) ? -EFAULT : 0;
+	case STACK_IOC_GET_DEPTH:
+		return put_user((__u32)st_depth(dev->st), (__u32 __user *)arg) ? -EFAULT : 0;
+	case STACK_IOC_PUSH_BATCH:
+	case STACK_IOC_POP_BATCH:
+		return ioctl_batch(dev, cmd, (struct stack_batch __user *)arg);
+	case STACK_IOC_GET_STATS:
+		memset(&stats, 0, sizeof(stats));
+		st_stats(dev->st, &stats);
+		return copy_to_user((void __user *)arg, &stats, sizeof(stats)) ? -EFAULT : 0;
+	default:
+		/* wakeups of the shared stack */
+		return ring_ioctl(dev->ring, cmd, arg);
+	}
+}
+
+/* maps the shared stack of the minor, see stack_ring.h */
+static int
+stack_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct stack_dev *dev = file->private_data;
+
 	dbg("");
 
-	st_clean();
+	return ring_mmap(dev->ring, vma);
+}
 
-	return 0;
+/* readable while there are items, writable while there is room
+ * Woken by the wait queues read()/write() sleep on.
+ */
+static unsigned int
+stack_dev_poll(struct file *file, poll_table *wait)
+{
+	struct stack_dev *dev = file->private_data;
+	unsigned int mask = 0;
+
+	dbg("");
+
+	poll_wait(file, &dev->read_wq, wait);
+	poll_wait(file, &dev->write_wq, wait);
+
+	if (!st_is_empty(dev->st))
+		mask |= POLLIN | POLLRDNORM;
+	if (!st_is_full(dev->st))
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
 }
 
 static struct file_operations fops = {
@@ -100,6 +376,8 @@ static struct file_operations fops = {
 	.open = stack_dev_open, /* open() */
 	.read = stack_dev_read, /* read() */
 	.write = stack_dev_write, /* write() */
+	.poll = stack_dev_poll, /* poll(), select(), epoll */
+	.mmap = stack_dev_mmap, /* mmap() */
 	.release = stack_dev_release, /* close() */
 /*
  * References:
@@ -107,17 +385,61 @@ static struct file_operations fops = {
  * [2] https://github.com/torvalds/linux/blob/master/fs/ext4/ioctl.c#L436
 */
 	.unlocked_ioctl = stack_dev_ioctl, /* unlocked_ioctl() */
+	.compat_ioctl = compat_ptr_ioctl, /* stack_ioctl.h has one layout, arg needs compat_ptr() */
 };
 
+/* /sys/class/stack_device/stack_device/depth: items on the stack
+ * Of the device's shared stack, private stacks are not listed.
+ */
+static ssize_t
+depth_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct stack_minor *minor = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", st_depth(minor->dev.st));
+}
+static DEVICE_ATTR_RO(depth);
+
+/* .../high_water: deepest stack so far, writing anything resets it */
+static ssize_t
+high_water_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct stack_minor *minor = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", st_high_water(minor->dev.st));
+}
+
+static ssize_t
+high_water_store(struct device *dev, struct device_attribute *attr,
+	const char *buf, size_t count)
+{
+	struct stack_minor *minor = dev_get_drvdata(dev);
+
+	st_reset_high_water(minor->dev.st);
+	return count;
+}
+static DEVICE_ATTR_RW(high_water);
+
+static struct attribute *stack_dev_attrs[] = {
+	&dev_attr_depth.attr,
+	&dev_attr_high_water.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(stack_dev);
+
 static void
 _stack_dev_exit(void)
 {
+	int i;
+
 	dbg("");
 
-	/* Remove /dev/stack_device node */
-	if (device != NULL) {
-		device_destroy(class, dev_first);
-		device = NULL;
+	/* Remove /dev/stack_device* nodes */
+	for (i = 0; minors != NULL && i < nr_devices; i++) {
+		if (minors[i].device != NULL) {
+			device_destroy(class, MKDEV(MAJOR(dev_first), MINOR(dev_first) + i));
+			minors[i].device = NULL;
+		}
 	}
 
 	/* Destroy device class */
@@ -134,22 +456,51 @@ _stack_dev_exit(void)
 
 	/* Un-register char device number */
 	if (dev_first != 0) {
-		unregister_chrdev_region(dev_first, CHARDEV_NR_DEVICES);
+		unregister_chrdev_region(dev_first, nr_devices);
 		dev_first = 0;
 	}
 
+	/* Free stacks */
+	for (i = 0; minors != NULL && i < nr_devices; i++) {
+		st_destroy(minors[i].dev.st);
+		ring_exit(&minors[i].ring);
+	}
+	kfree(minors);
+	minors = NULL;
+
 	info("[STACK_DEVICE] released");
 }
 
 static int __init
 stack_dev_init(void)
 {
-	int ret;
+	struct stack_minor *minor;
+	dev_t devt;
+	int ret, i;
 
 	dbg("");
 
+	if (nr_devices < 1 || nr_devices > MAX_DEVICES) {
+		err("nr_devices must be 1 to %d", MAX_DEVICES);
+		return -EINVAL;
+	}
+
+	/* One stack per minor */
+	minors = kcalloc(nr_devices, sizeof(*minors), GFP_KERNEL);
+	if (minors == NULL) {
+		err("Failed allocating devices");
+		goto error;
+	}
+	for (i = 0; i < nr_devices; i++) {
+		ring_init(&minors[i].ring);
+		if (stack_dev_setup(&minors[i].dev, &minors[i].ring) < 0) {
+			err("Failed allocating stack");
+			goto error;
+		}
+	}
+
 	/* Register char device number */
-	ret = alloc_chrdev_region(&dev_first, CHARDEV_NR_MINOR, CHARDEV_NR_DEVICES, CHARDEV_NAME);
+	ret = alloc_chrdev_region(&dev_first, CHARDEV_NR_MINOR, nr_devices, CHARDEV_NAME);
 	if (ret < 0) {
 		err("Failed allocating device number");
 		goto error;
@@ -165,26 +516,39 @@ stack_dev_init(void)
 	cdev->ops = &fops;
 
 	/* Add char device to the system */
-	ret = cdev_add(cdev, dev_first, CHARDEV_NR_DEVICES);
+	ret = cdev_add(cdev, dev_first, nr_devices);
 	if (ret < 0) {
 		err("Failed adding character device to the system");
 		goto error;
 	}
 
-	info("[STACK_DEVICE] allocated Major(%d) and Minor(%d)", MAJOR(dev_first), MINOR(dev_first));
+	info("[STACK_DEVICE] allocated Major(%d) and Minors(%d-%d)%s", MAJOR(dev_first),
+		MINOR(dev_first), MINOR(dev_first) + nr_devices - 1,
+		private_stacks ? ", private stacks" : "");
 
-	/* Create /dev/stack_device node
+	/* Create /dev/stack_device, /dev/stack_device1, ... nodes
 	 * Ref: https://github.com/euspectre/kedr/blob/master/sources/examples/sample_target/cfake.c
 	*/
 	class = class_create(THIS_MODULE, CHARDEV_NAME);
-	if (class == NULL) {
+	if (IS_ERR(class)) {
 		err("Failed creating device class");
+		class = NULL; /* nothing to destroy */
 		goto error;
 	}
-	device = device_create(class, NULL, dev_first, NULL, "%s", CHARDEV_NAME);
-	if (device == NULL) {
-		err("Failed creating /dev node");
-		goto error;
+	for (i = 0; i < nr_devices; i++) {
+		minor = &minors[i];
+		devt = MKDEV(MAJOR(dev_first), MINOR(dev_first) + i);
+		if (i == 0)
+			minor->device = device_create_with_groups(class, NULL, devt, minor,
+				stack_dev_groups, "%s", CHARDEV_NAME);
+		else
+			minor->device = device_create_with_groups(class, NULL, devt, minor,
+				stack_dev_groups, "%s%d", CHARDEV_NAME, i);
+		if (IS_ERR(minor->device)) {
+			err("Failed creating /dev node");
+			minor->device = NULL; /* nothing to destroy */
+			goto error;
+		}
 	}
 
 	return 0;
@@ -0,0 +1,103 @@
+#include "ring.h"
+#include "stack_ring.h"
+#include "utils.h"
+
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+
+#define RING_PAGES 16 /* default size of the shared stack, header included */
+
+static int ring_pages = RING_PAGES;
+module_param(ring_pages, int, 0444);
+MODULE_PARM_DESC(ring_pages, "pages of the mmap()ed shared stack (default 16)");
+
+static int
+ring_alloc(struct ring *ring)
+{
+	int ret = 0;
+
+	mutex_lock(&ring->mutex);
+	if (ring->shared != NULL)
+		goto out;
+
+	if (ring_pages <= 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* zeroed, lock free & stack empty */
+	ring->size = (size_t)ring_pages << PAGE_SHIFT;
+	ring->shared = vmalloc_user(ring->size);
+	if (ring->shared == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	ring->shared->capacity =
+		(ring->size - sizeof(*ring->shared)) / sizeof(ring->shared->items[0]);
+
+	dbg("%zu bytes, %u items", ring->size, ring->shared->capacity);
+out:
+	mutex_unlock(&ring->mutex);
+	return ret;
+}
+
+void ring_init(struct ring *ring)
+{
+	ring->shared = NULL;
+	ring->size = 0;
+	mutex_init(&ring->mutex);
+	init_waitqueue_head(&ring->wq);
+}
+
+int ring_mmap(struct ring *ring, struct vm_area_struct *vma)
+{
+	int ret;
+
+	dbg("");
+
+	/* whole stack or its start, shared */
+	if (vma->vm_pgoff != 0 || !(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	ret = ring_alloc(ring);
+	if (ret < 0)
+		return ret;
+
+	if (vma->vm_end - vma->vm_start > ring->size)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->shared, 0);
+}
+
+long ring_ioctl(struct ring *ring, unsigned int cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case STACK_RING_WAIT:
+		dbg("wait %lu", arg);
+		if (ring->shared == NULL)
+			return -EINVAL;
+
+		/* pushes & pops in user space bump seq before waking */
+		if (wait_event_interruptible(ring->wq,
+			ACCESS_ONCE(ring->shared->seq) != (__u32)arg))
+			return -ERESTARTSYS;
+		return 0;
+	case STACK_RING_WAKE:
+		dbg("wake");
+		wake_up_interruptible(&ring->wq);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+void ring_exit(struct ring *ring)
+{
+	dbg("");
+
+	/* module unloads only after every mapping is gone */
+	vfree(ring->shared);
+	ring->shared = NULL;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+
+struct stack_ring;
+
+/* Shared-memory stack of one device, see stack_ring.h for the layout &
+ * protocol
+*/
+struct ring {
+	struct stack_ring *shared; /* allocated by the first mmap(), kept until unload */
+	size_t size;
+	struct mutex mutex; /* protects allocation */
+	wait_queue_head_t wq; /* STACK_RING_WAIT sleepers */
+};
+
+/* Sets up an empty ring, memory is allocated on first mmap()
+*/
+void ring_init(struct ring *ring);
+
+/* Maps the shared stack, allocated on first use
+ * Returns < 0 on error
+*/
+int ring_mmap(struct ring *ring, struct vm_area_struct *vma);
+
+/* Handles STACK_RING_* commands
+ * Returns -ENOTTY for other commands, < 0 on error
+*/
+long ring_ioctl(struct ring *ring, unsigned int cmd, unsigned long arg);
+
+/* Frees the shared stack, called once no process maps it
+*/
+void ring_exit(struct ring *ring);
@@ -1,46 +1,449 @@
 #include "stack.h"
+#include "stack_ioctl.h"
 #include "utils.h"
 
 #include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/gfp.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
 
-#define STACK_SIZE 256
+#define MAX_DEPTH 65536 /* default limit of items on a stack */
+#define MAG_SIZE 32 /* items cached per CPU with magazines=1 */
+#define SHRINK_DELAY HZ /* spare chunks are freed after this long without pops */
 
-struct {
-	int stack[STACK_SIZE];
-	int top;
-} st = {
-	.top = -1, /* top is set to -1 to indicate empty stack */
+/* a page of a stack */
+struct chunk {
+	struct list_head list;
+	int items[];
 };
+#define CHUNK_ITEMS ((int)((PAGE_SIZE - sizeof(struct chunk)) / sizeof(int)))
 
-int st_is_empty(void)
+/* Per-CPU magazines (magazines=1)
+ * Pushes & pops go to the local CPU's magazine under its own, normally
+ * uncontended lock. A full magazine moves its older half to the shared
+ * stack, an empty one refills from it; lock order is magazine, then
+ * shared stack. Pops take from other CPUs' magazines only when the
+ * local one & the shared stack are empty, so no item is hidden from a
+ * reader. The stack is LIFO per CPU only, nr_items bounds all items.
+ * Ref: J. Bonwick, J. Adams, Magazines and Vmem, USENIX 2001
+ */
+struct magazine {
+	spinlock_t lock;
+	int items[MAG_SIZE];
+	int nr;
+};
+
+/* One stack
+ * The shared part, protected by lock, grows a page at a time. Chunks
+ * emptied by pops are kept as spares and only freed once the stack has
+ * been idle for SHRINK_DELAY, so a depth swinging around a chunk
+ * boundary does not allocate every time.
+ */
+struct stack {
+	spinlock_t lock;
+	struct list_head chunks; /* in use, top chunk first */
+	struct list_head spare;
+	int depth; /* items in chunks */
+
+	struct magazine __percpu *mags; /* NULL without magazines */
+	atomic_t nr_items; /* in chunks & magazines, with magazines */
+
+	atomic_t high_water; /* deepest stack seen */
+	atomic64_t nr_pushes; /* items, since creation */
+	atomic64_t nr_pops;
+	struct delayed_work shrink_work;
+};
+
+static int max_depth = MAX_DEPTH;
+module_param(max_depth, int, 0644);
+MODULE_PARM_DESC(max_depth, "most items a stack grows to (default 65536)");
+
+static bool magazines;
+module_param(magazines, bool, 0444);
+MODULE_PARM_DESC(magazines, "cache items in per-CPU magazines (default 0, plain locked stack)");
+
+/* chunked stack */
+
+static void
+note_depth(struct stack *st, int depth)
 {
-	dbg("");
+	int old;
+
+	while ((old = atomic_read(&st->high_water)) < depth &&
+		atomic_cmpxchg(&st->high_water, old, depth) != old)
+		;
+}
+
+static void
+free_chunks(struct list_head *chunks)
+{
+	struct chunk *chunk, *next;
+
+	list_for_each_entry_safe(chunk, next, chunks, list)
+		free_page((unsigned long)chunk);
+	INIT_LIST_HEAD(chunks);
+}
+
+/* frees spare chunks, runs once pops stopped for SHRINK_DELAY */
+static void
+shrink_fn(struct work_struct *work)
+{
+	struct stack *st = container_of(to_delayed_work(work), struct stack, shrink_work);
+	LIST_HEAD(spare);
+
+	spin_lock(&st->lock);
+	list_splice_init(&st->spare, &spare);
+	spin_unlock(&st->lock);
 
-	if (st.top == -1)
-		return 1;
+	free_chunks(&spare);
+}
+
+/* adds a page to the spare chunks, returns -ENOMEM if out of memory */
+static int
+add_spare(struct stack *st, gfp_t gfp)
+{
+	struct chunk *chunk;
+
+	chunk = (struct chunk *)__get_free_page(gfp);
+	if (chunk == NULL)
+		return -ENOMEM;
+
+	spin_lock(&st->lock);
+	list_add(&chunk->list, &st->spare);
+	spin_unlock(&st->lock);
 	return 0;
 }
 
-int st_is_full(void)
+/* Pushes up to nr items while below limit items, allocating chunks
+ * with gfp outside the lock. Returns number of items pushed, -ENOMEM
+ * if none for lack of memory.
+ */
+static int
+chunked_push_many(struct stack *st, const int *items, int nr, int limit, gfp_t gfp)
 {
-	dbg("");
+	struct chunk *chunk;
+	int done = 0, i;
+
+	spin_lock(&st->lock);
+	while (done < nr && st->depth < limit) {
+		/* top chunk is full, start the next one */
+		i = st->depth % CHUNK_ITEMS;
+		if (i == 0 && list_empty(&st->spare)) {
+			spin_unlock(&st->lock);
+			if (add_spare(st, gfp) < 0)
+				return done ? done : -ENOMEM;
+			spin_lock(&st->lock);
+			continue;
+		}
+		if (i == 0)
+			list_move(st->spare.next, &st->chunks);
+
+		/* add item */
+		chunk = list_first_entry(&st->chunks, struct chunk, list);
+		chunk->items[i] = items[done++];
+		st->depth++;
+	}
+	note_depth(st, st->depth);
+	spin_unlock(&st->lock);
+
+	return done;
+}
+
+/* top item of the shared stack, -ENODATA if empty */
+static int
+chunked_peek(struct stack *st, int *item)
+{
+	struct chunk *chunk;
+	int ret = -ENODATA;
+
+	spin_lock(&st->lock);
+	if (st->depth > 0) {
+		chunk = list_first_entry(&st->chunks, struct chunk, list);
+		*item = chunk->items[(st->depth - 1) % CHUNK_ITEMS];
+		ret = 0;
+	}
+	spin_unlock(&st->lock);
+
+	return ret;
+}
+
+/* pops up to nr items, top first, returns number of items popped */
+static int
+chunked_pop_many(struct stack *st, int *items, int nr)
+{
+	struct chunk *chunk;
+	int done = 0, emptied = 0;
+
+	spin_lock(&st->lock);
+	while (done < nr && st->depth > 0) {
+		/* remove item */
+		chunk = list_first_entry(&st->chunks, struct chunk, list);
+		st->depth--;
+		items[done++] = chunk->items[st->depth % CHUNK_ITEMS];
+
+		/* top chunk is empty, keep it for a while */
+		if (st->depth % CHUNK_ITEMS == 0) {
+			list_move(&chunk->list, &st->spare);
+			emptied = 1;
+		}
+	}
+	spin_unlock(&st->lock);
 
-	if (st.top >= STACK_SIZE - 1)
-		return 1;
+	/* pushed back while pops go on */
+	if (emptied)
+		mod_delayed_work(system_wq, &st->shrink_work, SHRINK_DELAY);
+
+	return done;
+}
+
+/* magazines */
+
+/* claims room for up to nr items, returns number of items claimed */
+static int
+mag_reserve(struct stack *st, int nr)
+{
+	int old, new;
+
+	do {
+		old = atomic_read(&st->nr_items);
+		new = min(old + nr, max(old, max_depth));
+		if (new == old)
+			return 0;
+	} while (atomic_cmpxchg(&st->nr_items, old, new) != old);
+
+	note_depth(st, new);
+	return new - old;
+}
+
+/* moves older half of a full magazine onto the shared stack
+ * nr_items keeps the stack below max_depth. Runs with preemption
+ * disabled, so chunks are allocated atomically.
+ * Returns -ENOMEM if nothing could be moved.
+ */
+static int
+mag_flush(struct stack *st, struct magazine *mag)
+{
+	int nr;
+
+	nr = chunked_push_many(st, mag->items, MAG_SIZE / 2, INT_MAX, GFP_ATOMIC);
+	if (nr < 0)
+		return nr;
+
+	memmove(mag->items, mag->items + nr, (mag->nr - nr) * sizeof(int));
+	mag->nr -= nr;
 	return 0;
 }
 
-int st_push(int item)
+/* moves up to half a magazine from top of shared stack into an empty
+ * magazine, keeping their order
+ * Returns number of items moved.
+ */
+static int
+mag_refill(struct stack *st, struct magazine *mag)
+{
+	int nr, i, tmp;
+
+	/* popped top first, the top item goes last */
+	nr = chunked_pop_many(st, mag->items, MAG_SIZE / 2);
+	for (i = 0; i < nr / 2; i++) {
+		tmp = mag->items[i];
+		mag->items[i] = mag->items[nr - 1 - i];
+		mag->items[nr - 1 - i] = tmp;
+	}
+
+	mag->nr = nr;
+	return nr;
+}
+
+static int
+mag_push_many(struct stack *st, const int *items, int nr)
+{
+	struct magazine *mag;
+	int i;
+
+	nr = mag_reserve(st, nr);
+	if (nr == 0)
+		return 0;
+
+	mag = get_cpu_ptr(st->mags);
+	spin_lock(&mag->lock);
+	for (i = 0; i < nr; i++) {
+		if (mag->nr == MAG_SIZE && mag_flush(st, mag) < 0)
+			break;
+		mag->items[mag->nr++] = items[i];
+	}
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(st->mags);
+
+	/* out of memory, give back the room not used */
+	if (i < nr)
+		atomic_sub(nr - i, &st->nr_items);
+	return i ? i : -ENOMEM;
+}
+
+static int
+mag_pop_many(struct stack *st, int *items, int nr)
+{
+	struct magazine *mag;
+	int done = 0, cpu;
+
+	/* local magazine, then shared stack */
+	mag = get_cpu_ptr(st->mags);
+	spin_lock(&mag->lock);
+	while (done < nr) {
+		if (mag->nr == 0 && mag_refill(st, mag) == 0)
+			break;
+		items[done++] = mag->items[--mag->nr];
+	}
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(st->mags);
+
+	/* items cached by other CPUs, one magazine lock at a time */
+	for_each_possible_cpu(cpu) {
+		if (done == nr)
+			break;
+		mag = per_cpu_ptr(st->mags, cpu);
+		spin_lock(&mag->lock);
+		while (done < nr && mag->nr > 0)
+			items[done++] = mag->items[--mag->nr];
+		spin_unlock(&mag->lock);
+	}
+
+	atomic_sub(done, &st->nr_items);
+	return done;
+}
+
+/* item mag_pop_many() would return first, in the same order */
+static int
+mag_peek(struct stack *st, int *item)
+{
+	struct magazine *mag;
+	int ret = -ENODATA, cpu;
+
+	mag = get_cpu_ptr(st->mags);
+	spin_lock(&mag->lock);
+	if (mag->nr > 0) {
+		*item = mag->items[mag->nr - 1];
+		ret = 0;
+	}
+	spin_unlock(&mag->lock);
+	put_cpu_ptr(st->mags);
+
+	if (ret == 0 || chunked_peek(st, item) == 0)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		mag = per_cpu_ptr(st->mags, cpu);
+		spin_lock(&mag->lock);
+		if (mag->nr > 0) {
+			*item = mag->items[mag->nr - 1];
+			ret = 0;
+		}
+		spin_unlock(&mag->lock);
+		if (ret == 0)
+			break;
+	}
+
+	return ret;
+}
+
+/* interface */
+
+struct stack *st_create(void)
+{
+	struct stack *st;
+	int cpu;
+
+	dbg("magazines %d, max_depth %d, %d items per chunk", magazines,
+		max_depth, CHUNK_ITEMS);
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (st == NULL)
+		return NULL;
+
+	spin_lock_init(&st->lock);
+	INIT_LIST_HEAD(&st->chunks);
+	INIT_LIST_HEAD(&st->spare);
+	st->depth = 0; /* depth is set to 0 to indicate empty stack */
+	INIT_DELAYED_WORK(&st->shrink_work, shrink_fn);
+
+	if (magazines) {
+		st->mags = alloc_percpu(struct magazine);
+		if (st->mags == NULL) {
+			kfree(st);
+			return NULL;
+		}
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(st->mags, cpu)->lock);
+	}
+
+	return st;
+}
+
+void st_destroy(struct stack *st)
 {
 	dbg("");
 
-	/* add item */
-	st.top++;
-	st.stack[st.top] = item;
-	return 0;
+	if (st == NULL)
+		return;
+
+	/* no more pops, so the work is not queued again */
+	cancel_delayed_work_sync(&st->shrink_work);
+
+	free_chunks(&st->chunks);
+	free_chunks(&st->spare);
+	free_percpu(st->mags);
+	kfree(st);
 }
 
-int st_pop(int *item)
+int st_is_empty(struct stack *st)
+{
+	dbg("");
+
+	return st_depth(st) == 0;
+}
+
+int st_is_full(struct stack *st)
+{
+	dbg("");
+
+	return st_depth(st) >= max_depth;
+}
+
+int st_depth(struct stack *st)
+{
+	if (st->mags != NULL)
+		return atomic_read(&st->nr_items);
+	return ACCESS_ONCE(st->depth);
+}
+
+int st_high_water(struct stack *st)
+{
+	return atomic_read(&st->high_water);
+}
+
+void st_reset_high_water(struct stack *st)
+{
+	atomic_set(&st->high_water, st_depth(st));
+}
+
+void st_stats(struct stack *st, struct stack_stats *stats)
+{
+	dbg("");
+
+	stats->pushes = atomic64_read(&st->nr_pushes);
+	stats->pops = atomic64_read(&st->nr_pops);
+	stats->depth = st_depth(st);
+	stats->high_water = st_high_water(st);
+	stats->max_depth = max_depth;
+	stats->magazines = st->mags != NULL;
+}
+
+int st_peek(struct stack *st, int *item)
 {
 	/* invalid arguments */
 	if (item == NULL)
@@ -48,18 +451,104 @@ int st_pop(int *item)
 
 	dbg("");
 
-	/* remove item */
-	*item = st.stack[st.top];
-	st.top--;
-	return 0;
+	return st->mags != NULL ? mag_peek(st, item) : chunked_peek(st, item);
+}
+
+int st_push(struct stack *st, int item)
+{
+	int ret;
+
+	dbg("");
+
+	ret = st_push_many(st, &item, 1);
+	if (ret < 0)
+		return ret;
+	return ret == 1 ? 0 : -ENOMEM;
 }
 
-void st_clean(void)
+int st_pop(struct stack *st, int *item)
 {
+	int ret;
+
+	/* invalid arguments */
+	if (item == NULL)
+		return -EINVAL;
+
 	dbg("");
 
-	/* setting top to -1 means stack is cleaned up
-	 * there is no way to access st
+	ret = st_pop_many(st, item, 1);
+	if (ret < 0)
+		return ret;
+	return ret == 1 ? 0 : -ENODATA;
+}
+
+int st_push_many(struct stack *st, const int *items, int nr)
+{
+	int ret;
+
+	/* invalid arguments */
+	if (items == NULL || nr < 0)
+		return -EINVAL;
+
+	dbg("%d", nr);
+
+	if (st->mags != NULL)
+		ret = mag_push_many(st, items, nr);
+	else
+		ret = chunked_push_many(st, items, nr, max_depth, GFP_KERNEL);
+
+	if (ret > 0)
+		atomic64_add(ret, &st->nr_pushes);
+	return ret;
+}
+
+int st_pop_many(struct stack *st, int *items, int nr)
+{
+	int ret;
+
+	/* invalid arguments */
+	if (items == NULL || nr < 0)
+		return -EINVAL;
+
+	dbg("%d", nr);
+
+	if (st->mags != NULL)
+		ret = mag_pop_many(st, items, nr);
+	else
+		ret = chunked_pop_many(st, items, nr);
+
+	if (ret > 0)
+		atomic64_add(ret, &st->nr_pops);
+	return ret;
+}
+
+void st_clean(struct stack *st)
+{
+	struct magazine *mag;
+	int cpu;
+
+	dbg("");
+
+	/* setting depth to 0 means stack is cleaned up,
+	 * its chunks become spares
 	*/
-	st.top = -1;
-}
\ No newline at end of file
+	spin_lock(&st->lock);
+	if (st->mags != NULL)
+		atomic_sub(st->depth, &st->nr_items);
+	list_splice_init(&st->chunks, &st->spare);
+	st->depth = 0;
+	spin_unlock(&st->lock);
+	mod_delayed_work(system_wq, &st->shrink_work, SHRINK_DELAY);
+
+	if (st->mags == NULL)
+		return;
+
+	/* items pushed meanwhile survive, as if pushed after the clean */
+	for_each_possible_cpu(cpu) {
+		mag = per_cpu_ptr(st->mags, cpu);
+		spin_lock(&mag->lock);
+		atomic_sub(mag->nr, &st->nr_items);
+		mag->nr = 0;
+		spin_unlock(&mag->lock);
+	}
+}
@@ -1,23 +1,77 @@
 #pragma once
 
+/* Every function may be called concurrently on the same stack; stacks
+ * are independent of each other. With the module parameter magazines=1
+ * items are cached per CPU, a stack is LIFO per CPU only. A stack grows
+ * a page at a time up to max_depth items (module parameter).
+*/
+
+struct stack;
+
+/* Allocates an empty stack, with per-CPU magazines if enabled
+ * Returns NULL if out of memory
+*/
+struct stack *st_create(void);
+
+/* Frees the stack & all its memory, called once after every other
+ * function on it. Accepts NULL.
+*/
+void st_destroy(struct stack *st);
+
 /* True (1) if no more items can be popped and there is no top item
+ * A snapshot, concurrent calls may change it right after
 */
-int st_is_empty(void);
+int st_is_empty(struct stack *st);
 
 /* True (1) if no more items can be pushed
+ * A snapshot, concurrent calls may change it right after
+*/
+int st_is_full(struct stack *st);
+
+/* Items on the stack, a snapshot
+*/
+int st_depth(struct stack *st);
+
+/* Most items the stack held since creation or the last reset
 */
-int st_is_full(void);
+int st_high_water(struct stack *st);
+
+/* Restarts high-water tracking at the current depth
+*/
+void st_reset_high_water(struct stack *st);
+
+struct stack_stats;
+
+/* Fills counters & settings, see stack_ioctl.h
+*/
+void st_stats(struct stack *st, struct stack_stats *stats);
+
+/* Copies the item the next pop on this CPU would return, without popping
+ * Returns < 0 on error, -ENODATA if empty
+*/
+int st_peek(struct stack *st, int *item);
 
 /* Adds an item onto the stack
- * Returns < 0 on error
+ * Returns < 0 on error, -ENOMEM if full or out of memory
 */
-int st_push(int item);
+int st_push(struct stack *st, int item);
 
 /* Removes the most-recently-pushed item from the stack (as out argument)
- * Returns < 0 on error
+ * Returns < 0 on error, -ENODATA if empty
+*/
+int st_pop(struct stack *st, int *item);
+
+/* Adds up to nr items onto the stack, items[nr - 1] ends up on top
+ * Returns number of items pushed (0 if full), < 0 on error (-ENOMEM if
+ * out of memory)
+*/
+int st_push_many(struct stack *st, const int *items, int nr);
+
+/* Removes up to nr items from the stack, most-recently-pushed first
+ * Returns number of items popped (0 if empty), < 0 on error
 */
-int st_pop(int *item);
+int st_pop_many(struct stack *st, int *items, int nr);
 
 /* Cleans up stack
 */
-void st_clean(void);
\ No newline at end of file
+void st_clean(struct stack *st);
\ No newline at end of file
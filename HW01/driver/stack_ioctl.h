@@ -0,0 +1,41 @@
+#pragma once
+
+/* ioctl() commands of /dev/stack_device, shared by driver & apps
+*/
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define STACK_IOC_MAGIC 'S'
+
+/* user-space array of PUSH_BATCH/POP_BATCH */
+struct stack_batch {
+	__u64 items; /* int array, pointer cast to __u64 */
+	__u32 nr; /* items in the array */
+	__u32 done; /* out: items pushed or popped */
+};
+
+struct stack_stats {
+	__u64 pushes; /* items pushed since loading */
+	__u64 pops; /* items popped since loading */
+	__u32 depth; /* items on the stack */
+	__u32 high_water; /* see sysfs high_water */
+	__u32 max_depth; /* module parameter */
+	__u32 magazines; /* module parameter */
+};
+
+/* empties the stack */
+#define STACK_IOC_CLEAN _IO(STACK_IOC_MAGIC, 0x10)
+/* top item without popping it, ENODATA if empty */
+#define STACK_IOC_PEEK _IOR(STACK_IOC_MAGIC, 0x11, int)
+/* items on the stack */
+#define STACK_IOC_GET_DEPTH _IOR(STACK_IOC_MAGIC, 0x12, __u32)
+/* push up to nr items, items[nr - 1] on top, never blocks */
+#define STACK_IOC_PUSH_BATCH _IOWR(STACK_IOC_MAGIC, 0x13, struct stack_batch)
+/* pop up to nr items, top first, never blocks */
+#define STACK_IOC_POP_BATCH _IOWR(STACK_IOC_MAGIC, 0x14, struct stack_batch)
+#define STACK_IOC_GET_STATS _IOR(STACK_IOC_MAGIC, 0x15, struct stack_stats)
+
+/* shared stack wakeups, see stack_ring.h */
+#define STACK_RING_WAIT _IO(STACK_IOC_MAGIC, 1) /* arg: seq seen, by value */
+#define STACK_RING_WAKE _IO(STACK_IOC_MAGIC, 2)
@@ -0,0 +1,95 @@
+#pragma once
+
+/* Shared-memory stack of /dev/stack_device, shared by driver & apps
+ *
+ * mmap() of the device maps a stack living in pages shared by every
+ * process mapping it, next to the stack read()/write() work on. Items
+ * are pushed & popped in user space under a lock word taken with an
+ * atomic exchange, no system call involved. System calls are only
+ * needed to sleep until the stack changes and to wake sleepers:
+ * STACK_RING_WAIT sleeps while seq still holds its argument,
+ * STACK_RING_WAKE wakes every sleeper, needed only while waiters > 0.
+ * Meant for cooperating processes, anyone mapping the device can
+ * corrupt it.
+*/
+
+#include "stack_ioctl.h"
+
+struct stack_ring {
+	__u32 lock; /* 0: free, 1: held */
+	__u32 top; /* items on the stack */
+	__u32 capacity; /* length of items[], set by the driver */
+	__u32 waiters; /* threads in STACK_RING_WAIT or about to be */
+	__u32 seq; /* bumped by every push & pop */
+	__s32 items[];
+};
+
+#ifndef __KERNEL__
+
+#include <sys/ioctl.h>
+
+static inline void
+stack_ring_lock(struct stack_ring *ring)
+{
+	while (__atomic_exchange_n(&ring->lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&ring->lock, __ATOMIC_RELAXED))
+			;
+}
+
+/* publishes the change, wakes sleepers if there are any */
+static inline void
+stack_ring_unlock(struct stack_ring *ring, int fd, int changed)
+{
+	if (changed)
+		__atomic_add_fetch(&ring->seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&ring->lock, 0, __ATOMIC_RELEASE);
+
+	if (changed && __atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST))
+		ioctl(fd, STACK_RING_WAKE);
+}
+
+/* returns 0 if pushed, -1 if full */
+static inline int
+stack_ring_push(struct stack_ring *ring, int fd, int item)
+{
+	int full;
+
+	stack_ring_lock(ring);
+	full = ring->top == ring->capacity;
+	if (!full)
+		ring->items[ring->top++] = item;
+	stack_ring_unlock(ring, fd, !full);
+
+	return full ? -1 : 0;
+}
+
+/* returns 0 if popped, -1 if empty */
+static inline int
+stack_ring_pop(struct stack_ring *ring, int fd, int *item)
+{
+	int empty;
+
+	stack_ring_lock(ring);
+	empty = ring->top == 0;
+	if (!empty)
+		*item = ring->items[--ring->top];
+	stack_ring_unlock(ring, fd, !empty);
+
+	return empty ? -1 : 0;
+}
+
+/* sleeps until the stack changes after seq 'seen' was read */
+static inline int
+stack_ring_wait(struct stack_ring *ring, int fd, __u32 seen)
+{
+	int ret = 0;
+
+	__atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->seq, __ATOMIC_SEQ_CST) == seen)
+		ret = ioctl(fd, STACK_RING_WAIT, seen);
+	__atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+
+	return ret;
+}
+
+#endif
@@ -5,9 +5,11 @@
 #define DEBUG_ENABLE /* uncomment to enable debugging logs */
 
 #ifdef DEBUG_ENABLE
+	extern bool stack_debug; /* 'debug' module param, off by default */
 	#define dbg(fmt,args...) \
 		do { \
-			printk(KERN_DEBUG "<%s:%d> " fmt "\n", __func__, __LINE__, ##args); \
+			if (stack_debug) \
+				printk(KERN_DEBUG "<%s:%d> " fmt "\n", __func__, __LINE__, ##args); \
 		} while (0)
 #else
 	#define dbg(fmt,args...)
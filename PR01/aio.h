@@ -0,0 +1,38 @@
+#pragma once
+
+/* Linux native AIO
+ * glibc has no wrappers for the io_* system calls and libaio may not be
+ * installed, so the few calls fsbench needs are made directly.
+ * Without O_DIRECT most file systems complete requests inside io_submit(),
+ * i.e. synchronously.
+ */
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+static inline int
+io_setup(unsigned int nr_events, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr_events, ctx);
+}
+
+static inline int
+io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static inline int
+io_submit(aio_context_t ctx, long nr, struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static inline int
+io_getevents(aio_context_t ctx, long min_nr, long nr, struct io_event *events,
+	struct timespec *timeout)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
@@ -0,0 +1,197 @@
+/*
+	CPU, syscall & hardware counter accounting for fsbench
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "fsbench.h"
+#include "cpu.h"
+
+enum {
+	HW_CYCLES,
+	HW_INSTRUCTIONS,
+	HW_CACHE_MISSES,
+	NR_HW_COUNTERS,
+};
+
+static const unsigned long long hw_config[NR_HW_COUNTERS] = {
+	[HW_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+	[HW_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+	[HW_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static int hw_fd[NR_HW_COUNTERS] = { -1, -1, -1 };
+
+/* reading /proc/self/io is a read syscall itself */
+static long long sample_syscalls;
+
+static long
+perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd,
+	unsigned long flags)
+{
+	return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+void
+cpu_init(void)
+{
+	struct perf_event_attr attr;
+	struct cpu_usage a, b;
+	int i;
+
+	cpu_sample(&a);
+	cpu_sample(&b);
+	if (a.syscalls >= 0 && b.syscalls >= 0)
+		sample_syscalls = b.syscalls - a.syscalls;
+
+	if (!conf.perf_counters)
+		return;
+
+	/* count this process and every thread it creates later on;
+	 * counts of a thread are added when it exits
+	 */
+	for (i = 0; i < NR_HW_COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = hw_config[i];
+		attr.inherit = 1;
+		attr.exclude_hv = 1;
+
+		hw_fd[i] = perf_event_open(&attr, 0, -1, -1, 0);
+		if (hw_fd[i] == -1)
+			err("perf_event_open() failed: [%s], counter disabled", strerror(errno));
+	}
+}
+
+static long long
+hw_read(int counter)
+{
+	unsigned long long value;
+
+	if (hw_fd[counter] == -1 ||
+		read(hw_fd[counter], &value, sizeof(value)) != sizeof(value))
+		return -1;
+	return value;
+}
+
+/* syscr + syscw of /proc/<pid>/io, -1 without task I/O accounting */
+static long long
+proc_syscalls(const char *pid)
+{
+	char path[64], line[128];
+	long long value, total = 0;
+	int found = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%s/io", pid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "syscr: %lld", &value) == 1 ||
+			sscanf(line, "syscw: %lld", &value) == 1) {
+			total += value;
+			found++;
+		}
+	}
+	fclose(fp);
+
+	return found == 2 ? total : -1;
+}
+
+/* utime & stime of all threads of 'pid', from /proc/<pid>/stat */
+static int
+proc_cpu_time(int pid, long *utime, long *stime)
+{
+	unsigned long long ut, st;
+	char path[64], buf[1024], *p;
+	long ticks = sysconf(_SC_CLK_TCK);
+	FILE *fp;
+	int ret;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	p = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+
+	/* comm may contain spaces, fields 14 & 15 follow the last ')' */
+	if (p == NULL || (p = strrchr(buf, ')')) == NULL)
+		return -1;
+	ret = sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+		&ut, &st);
+	if (ret != 2)
+		return -1;
+
+	*utime = ut * 1000000 / ticks;
+	*stime = st * 1000000 / ticks;
+	return 0;
+}
+
+void
+cpu_sample(struct cpu_usage *u)
+{
+	struct rusage ru;
+	char pid[16];
+
+	getrusage(RUSAGE_SELF, &ru);
+	u->utime = ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec;
+	u->stime = ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec;
+	u->nvcsw = ru.ru_nvcsw;
+	u->nivcsw = ru.ru_nivcsw;
+	u->minflt = ru.ru_minflt;
+	u->majflt = ru.ru_majflt;
+	u->syscalls = proc_syscalls("self");
+
+	u->srv_utime = u->srv_stime = -1;
+	u->srv_syscalls = -1;
+	if (conf.server_pid > 0) {
+		if (proc_cpu_time(conf.server_pid, &u->srv_utime, &u->srv_stime) < 0)
+			u->srv_utime = u->srv_stime = -1;
+		snprintf(pid, sizeof(pid), "%d", conf.server_pid);
+		u->srv_syscalls = proc_syscalls(pid);
+	}
+
+	u->cycles = hw_read(HW_CYCLES);
+	u->instructions = hw_read(HW_INSTRUCTIONS);
+	u->cache_misses = hw_read(HW_CACHE_MISSES);
+}
+
+#define DIFF(field) \
+	do { \
+		end->field = (end->field < 0 || start->field < 0) ? -1 : \
+			end->field - start->field; \
+	} while (0)
+
+void
+cpu_diff(struct cpu_usage *end, const struct cpu_usage *start)
+{
+	DIFF(utime);
+	DIFF(stime);
+	DIFF(nvcsw);
+	DIFF(nivcsw);
+	DIFF(minflt);
+	DIFF(majflt);
+	DIFF(syscalls);
+	if (end->syscalls >= sample_syscalls)
+		end->syscalls -= sample_syscalls;
+	DIFF(srv_utime);
+	DIFF(srv_stime);
+	DIFF(srv_syscalls);
+	DIFF(cycles);
+	DIFF(instructions);
+	DIFF(cache_misses);
+}
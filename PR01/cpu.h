@@ -0,0 +1,33 @@
+#pragma once
+
+/* Resource usage of a phase
+ * Process wide counters, sampled before and after each phase. Values
+ * that could not be read are -1.
+ */
+struct cpu_usage {
+	long utime; /* usec */
+	long stime;
+	long nvcsw; /* voluntary context switches */
+	long nivcsw;
+	long minflt;
+	long majflt;
+	long long syscalls; /* read & write class syscalls, /proc/<pid>/io */
+
+	/* file system server given with -U, e.g. the bbfs daemon */
+	long srv_utime;
+	long srv_stime;
+	long long srv_syscalls;
+
+	/* hardware counters with -H */
+	long long cycles;
+	long long instructions;
+	long long cache_misses;
+};
+
+/* opens hardware counters, before any worker thread is created */
+void cpu_init(void);
+
+void cpu_sample(struct cpu_usage *u);
+
+/* end -= start, counters unavailable in either stay -1 */
+void cpu_diff(struct cpu_usage *end, const struct cpu_usage *start);
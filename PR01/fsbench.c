@@ -13,407 +13,1763 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 #include <malloc.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
 
-#define err(fmt,args...) \
-	do { \
-		fprintf(stderr, "<%s:%d> " fmt "\n", __func__, __LINE__, ##args); \
-	} while (0)
+#include "fsbench.h"
+#include "report.h"
+#include "aio.h"
+#include "trace.h"
+#include "md.h"
+#include "verify.h"
 
-#define info(fmt,args...) \
-	do { \
-		fprintf(stdout, fmt "\n", ##args); \
-	} while (0)
+#define NUMFILES 1 /* default number of files */
+#define FILESIZE (1 * 1024 * 1024) /* default file size, 1MB */
+#define RAND_SEED 30
+#define VERIFY_RETRIES 3 /* re-reads of a block a concurrent write may have torn */
+#define MAX_MISMATCH_REPORTS 10 /* per phase */
+#define MD_WIDTH 4 /* default directory tree of metadata phases */
+#define MD_DEPTH 1
+#define MD_FILES 16
+#define COMPARE_ALPHA 0.05 /* significance level of compare mode */
+#define COMPARE_THRESHOLD 5.0 /* smaller changes (%) are noise */
 
-#define NUMFILES 1
-#define FILESIZE (1 * 1024 * 1024) /* 1MB */
+const struct phase_desc phase_info[NR_PHASE_TYPES] = {
+	[PHASE_CREATE] = { "create", "File Create" },
+	[PHASE_SEQ_WRITE] = { "seqwrite", "Sequential Write" },
+	[PHASE_SEQ_READ] = { "seqread", "Sequential Read" },
+	[PHASE_RAND_WRITE] = { "randwrite", "Random Write" },
+	[PHASE_RAND_READ] = { "randread", "Random Read" },
+	[PHASE_MIXED] = { "mixed", "Mixed Read/Write" },
+	[PHASE_REPLAY] = { "replay", "Trace Replay" },
+	[PHASE_MMAP_SEQ_WRITE] = { "mmapseqwrite", "Mmap Seq Write" },
+	[PHASE_MMAP_SEQ_READ] = { "mmapseqread", "Mmap Seq Read" },
+	[PHASE_MMAP_RAND_WRITE] = { "mmaprandwrite", "Mmap Rand Write" },
+	[PHASE_MMAP_RAND_READ] = { "mmaprandread", "Mmap Rand Read" },
+	[PHASE_MKDIR] = { "mkdir", "Directory Create" },
+	[PHASE_MDCREATE] = { "mdcreate", "Tree File Create" },
+	[PHASE_STAT] = { "stat", "File Stat" },
+	[PHASE_READDIR] = { "readdir", "Directory Read" },
+	[PHASE_RENAME] = { "rename", "File Rename" },
+	[PHASE_UNLINK] = { "unlink", "File Unlink" },
+	[PHASE_RMDIR] = { "rmdir", "Directory Remove" },
+	[PHASE_DELETE] = { "delete", "File Delete" },
+};
 
-char *dirname;
-int req_size;
-ssize_t act_size;
+const char *engine_name[NR_ENGINES] = {
+	[ENGINE_SYNC] = "sync",
+	[ENGINE_AIO] = "aio",
+};
+
+struct config conf = {
+	.nr_files = NUMFILES,
+	.size_min = FILESIZE,
+	.size_max = FILESIZE,
+	.nr_threads = 1,
+	.qdepth = 1,
+	.read_pct = 50,
+	.dist_str = "uniform",
+	.direct_phases = 1 << PHASE_SEQ_WRITE | 1 << PHASE_RAND_WRITE,
+	.direct_str = "seqwrite,randwrite",
+	.fsync_str = "none",
+	.mmap_touch = 4096,
+	.mmap_advice = MADV_NORMAL,
+	.mmap_advice_str = "normal",
+	.md_width = MD_WIDTH,
+	.md_depth = MD_DEPTH,
+	.md_files = MD_FILES,
+	.replay_speed = 1,
+	.nr_runs = 1,
+};
+
+/* the original fixed sequence */
+static const enum phase_type default_phases[] = {
+	PHASE_CREATE, PHASE_SEQ_WRITE, PHASE_SEQ_READ,
+	PHASE_RAND_WRITE, PHASE_RAND_READ, PHASE_DELETE,
+};
+
+/* default with -M */
+static const enum phase_type md_phases[] = {
+	PHASE_MKDIR, PHASE_MDCREATE, PHASE_STAT, PHASE_READDIR,
+	PHASE_RENAME, PHASE_UNLINK, PHASE_RMDIR,
+};
+
+static off_t *file_size; /* size of each file */
+static size_t trace_max_size; /* largest request of trace */
+
+/* Unique (non-repeating) random numbers in O(1), see shuffle_next() */
+struct shuffle {
+	long long *pool;
+	long long left;
+};
+
+/* Zipfian ranks over n items, see zipf_next() */
+struct zipf {
+	long long n;
+	double zetan; /* sum of 1/i^theta, i = 1..n */
+	double alpha;
+	double eta;
+};
+
+/* A job works on every nr_threads'th file. With the sync engine its
+ * 'qdepth' workers share the job's request stream, so the job keeps up to
+ * 'qdepth' requests in flight. With the aio engine a single worker keeps
+ * 'qdepth' requests queued in the kernel. Replay is the exception: each
+ * of the job's files is pinned to one worker, see replay_next().
+ */
+struct job {
+	int id;
+	int nr_files;
+	int *files; /* global file numbers */
+	int *fds; /* open during read/write phases */
+	char **maps; /* mapped during mmap phases */
+	long long *first_block; /* first request of each file, prefix sum */
+	long long nr_blocks; /* requests in one pass over all files */
+	uint32_t *gen; /* with -V, generation last written to each block */
+
+	pthread_mutex_t lock; /* protects members below */
+	long long cursor; /* sequential phases */
+	struct shuffle shuffle; /* random phases, uniform */
+	struct zipf zipf; /* random phases, zipf */
+	unsigned int seed;
+
+	struct trace_rec *trace; /* replay phase, file is index into 'files' */
+	long long nr_trace;
+
+	struct md_tree md; /* metadata phases, <dirname>/md-<id> */
+};
+
+struct worker {
+	pthread_t thread;
+	struct job *job;
+	struct phase *phase;
+	unsigned int seed; /* read/write choice of mixed phase */
+	int lane; /* replay phase, files with index % qdepth == lane */
+	long long cursor; /* replay phase, next trace record to look at */
+	char *buf; /* req_size bytes per request in flight */
+	long long unsynced; /* writes since last fsync(), with -F <n> */
+	long long ops;
+	long long bytes;
+	struct hist hist; /* latency of each request, nsec */
+};
+
+static struct job *jobs;
 
 static void
 usage(char *prog)
 {
-	err("Usage: %s <working directory> <request size>",
-		prog);
+	err("Usage: %s [options] <working directory> <request size>\n"
+		"       %s -c <baseline.csv> <candidate.csv>\n"
+		"  -n <files>        number of files (default %d)\n"
+		"  -s <size>         file size, <size>, <min>-<max> or <min>-<max>:log\n"
+		"                    (uniform or log-uniform, default 1M)\n"
+		"  -t <threads>      worker threads, files are split among them (default 1)\n"
+		"  -q <depth>        requests in flight per thread (default 1)\n"
+		"  -e <engine>       sync (pread/pwrite from 'depth' threads) or aio\n"
+		"                    (Linux native AIO, always O_DIRECT, default sync)\n"
+		"  -D <phase,...>    open files of these phases with O_DIRECT, all, none\n"
+		"                    (default seqwrite,randwrite)\n"
+		"  -F <n>|end        fsync() after every <n> writes of a worker and at\n"
+		"                    the end of write phases, or only at the end\n"
+		"  -f                preallocate files (fallocate) in create phase\n"
+		"  -C                evict files from page cache (fdatasync & fadvise\n"
+		"                    DONTNEED) before every I/O phase, untimed\n"
+		"  -m <read %%>       read share of mixed phase (default 50)\n"
+		"  -T <seconds>      run each I/O phase for this long\n"
+		"  -B <bytes>        run each I/O phase for this many bytes\n"
+		"  -p <phase,...>    phases to run, any of create, seqwrite, seqread,\n"
+		"                    randwrite, randread, mixed, replay, delete,\n"
+		"                    mmapseqwrite, mmapseqread, mmaprandwrite, mmaprandread and\n"
+		"                    metadata phases mkdir, mdcreate, stat, readdir,\n"
+		"                    rename, unlink, rmdir\n"
+		"                    (default create,seqwrite,seqread,randwrite,randread,delete,\n"
+		"                    create,replay,delete with -r, all metadata phases with -M)\n"
+		"  -g <stride>       mmap phases touch one byte every <stride> bytes of\n"
+		"                    a request, 0 copies the whole request (default 4096)\n"
+		"  -P                map files with MAP_POPULATE\n"
+		"  -A <advice>       madvise() mappings with normal, sequential, random,\n"
+		"                    willneed or hugepage (default normal)\n"
+		"  -M <w>x<d>x<f>    directory tree of metadata phases per thread, <w>\n"
+		"                    subdirectories per directory, <d> levels deep, <f>\n"
+		"                    files in each directory (default %dx%dx%d)\n"
+		"  -d <dist>         block popularity of random phases: uniform (each\n"
+		"                    block once per pass), zipf[:<theta>] (default 0.99)\n"
+		"                    or hotspot[:<hot %%>:<access %%>] (default 20:80)\n"
+		"  -r <trace>        requests of replay phase, lines of\n"
+		"                    <R|W> <file> <offset> <size> <timestamp sec>\n"
+		"  -S <speedup>      replay timestamps sped up by this factor,\n"
+		"                    0 issues requests back to back (default 1)\n"
+		"  -V <seed>         stamp written blocks with a seeded pattern & checksum,\n"
+		"                    verify blocks read back, exits with 1 on mismatches\n"
+		"  -H                count cycles, instructions and cache misses\n"
+		"                    (perf_event_open)\n"
+		"  -U <pid>          also account CPU time and syscalls of this process,\n"
+		"                    e.g. the bbfs daemon\n"
+		"  -R <runs>         repeat the whole phase sequence (default 1)\n"
+		"  -o <file>         save config, environment and results,\n"
+		"                    JSON if <file> ends with .json, CSV otherwise\n"
+		"  -c                compare two CSV result files, exits with 1 if the\n"
+		"                    candidate is significantly slower (Welch's t-test\n"
+		"                    over runs, p < %.2f, change > %.0f%%)",
+		prog, prog, NUMFILES, MD_WIDTH, MD_DEPTH, MD_FILES,
+		COMPARE_ALPHA, COMPARE_THRESHOLD);
 	exit(1);
 }
 
 static long
 gettimeusec(void)
 {
-	struct timeval time;
-	long usec; 
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (time.tv_sec * 1000000 + time.tv_nsec / 1000);
+}
+
+static uint64_t
+gettimensec(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/* parses sizes such as 4096, 4K, 1M, 2G */
+static long long
+parse_size(const char *str)
+{
+	char *end;
+	long long size;
+
+	size = strtoll(str, &end, 10);
+	switch (*end) {
+	case 'G': case 'g':
+		size *= 1024;
+		/* fall through */
+	case 'M': case 'm':
+		size *= 1024;
+		/* fall through */
+	case 'K': case 'k':
+		size *= 1024;
+		end++;
+		break;
+	}
+
+	if (end == str || (*end != '\0' && *end != '-' && *end != ':'))
+		return -1;
+	return size;
+}
+
+static void
+parse_file_size(const char *str)
+{
+	const char *max;
+
+	conf.size_min = parse_size(str);
+	conf.size_max = conf.size_min;
+
+	max = strchr(str, '-');
+	if (max != NULL) {
+		conf.size_max = parse_size(max + 1);
+		conf.size_log = strstr(max, ":log") != NULL;
+	}
+
+	if (conf.size_min <= 0 || conf.size_max < conf.size_min) {
+		err("invalid file size: %s", str);
+		exit(1);
+	}
+}
+
+static void
+parse_phases(char *str)
+{
+	char *name, *saveptr = NULL;
+	unsigned int i;
+
+	conf.nr_phases = 0;
+	for (name = strtok_r(str, ",", &saveptr); name != NULL;
+			name = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < NR_PHASE_TYPES; i++) {
+			if (strcmp(name, phase_info[i].name) == 0)
+				break;
+		}
+		if (i == NR_PHASE_TYPES || conf.nr_phases == MAX_PHASES) {
+			err("unknown phase (or too many): %s", name);
+			exit(1);
+		}
+		conf.phases[conf.nr_phases++] = i;
+	}
+}
+
+/* phases opened with O_DIRECT, see open_files() */
+static void
+parse_direct(char *str)
+{
+	char *name, *saveptr = NULL;
+	unsigned int i;
+
+	conf.direct_str = strdup(str);
+	conf.direct_phases = 0;
+	if (strcmp(str, "none") == 0)
+		return;
+	if (strcmp(str, "all") == 0) {
+		conf.direct_phases = 1 << PHASE_SEQ_WRITE | 1 << PHASE_SEQ_READ |
+			1 << PHASE_RAND_WRITE | 1 << PHASE_RAND_READ | 1 << PHASE_MIXED;
+		return;
+	}
+
+	for (name = strtok_r(str, ",", &saveptr); name != NULL;
+			name = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < NR_PHASE_TYPES; i++) {
+			if (strcmp(name, phase_info[i].name) == 0)
+				break;
+		}
+		/* traced requests need not be aligned, mappings bypass read/write */
+		if (i > PHASE_MIXED || i == PHASE_CREATE) {
+			err("no direct I/O in phase: %s", name);
+			exit(1);
+		}
+		conf.direct_phases |= 1 << i;
+	}
+}
+
+static void
+parse_fsync(char *str)
+{
+	conf.fsync_str = str;
+	conf.fsync_end = 1;
+	if (strcmp(str, "end") == 0)
+		return;
+
+	conf.fsync_ops = atoi(str);
+	if (conf.fsync_ops <= 0) {
+		err("invalid fsync interval: %s", str);
+		exit(1);
+	}
+}
+
+static void
+parse_dist(char *str)
+{
+	char *arg = strchr(str, ':');
+
+	conf.dist_str = str;
+	if (arg != NULL)
+		*arg++ = '\0';
+
+	if (strcmp(str, "uniform") == 0) {
+		conf.dist = DIST_UNIFORM;
+	} else if (strcmp(str, "zipf") == 0) {
+		conf.dist = DIST_ZIPF;
+		conf.zipf_theta = arg ? atof(arg) : 0.99;
+	} else if (strcmp(str, "hotspot") == 0) {
+		conf.dist = DIST_HOTSPOT;
+		conf.hot_pct = 20;
+		conf.hot_access_pct = 80;
+		if (arg != NULL &&
+			sscanf(arg, "%lf:%lf", &conf.hot_pct, &conf.hot_access_pct) != 2) {
+			err("invalid hotspot: %s", arg);
+			exit(1);
+		}
+	} else {
+		err("unknown distribution: %s", str);
+		exit(1);
+	}
+
+	/* zipf_next() needs theta != 1 */
+	if ((conf.dist == DIST_ZIPF && (conf.zipf_theta <= 0 || conf.zipf_theta >= 1)) ||
+		(conf.dist == DIST_HOTSPOT &&
+		 (conf.hot_pct <= 0 || conf.hot_pct >= 100 ||
+		  conf.hot_access_pct < 0 || conf.hot_access_pct > 100))) {
+		err("invalid %s parameters", str);
+		exit(1);
+	}
+
+	/* restore for result files */
+	if (arg != NULL)
+		arg[-1] = ':';
+}
+
+static void
+parse_advice(char *str)
+{
+	static const struct {
+		const char *name;
+		int advice;
+	} advices[] = {
+		{ "normal", MADV_NORMAL },
+		{ "sequential", MADV_SEQUENTIAL },
+		{ "random", MADV_RANDOM },
+		{ "willneed", MADV_WILLNEED },
+		{ "hugepage", MADV_HUGEPAGE },
+	};
+	unsigned int i;
 
-	gettimeofday(&time, NULL);
+	for (i = 0; i < sizeof(advices) / sizeof(advices[0]); i++) {
+		if (strcmp(str, advices[i].name) == 0) {
+			conf.mmap_advice = advices[i].advice;
+			conf.mmap_advice_str = str;
+			return;
+		}
+	}
 
-	usec = (time.tv_sec * 1000000 + time.tv_usec);
-	return usec;
+	err("unknown advice: %s", str);
+	exit(1);
+}
+
+static int compare_mode;
+
+static void
+parse_args(int argc, char **argv)
+{
+	int opt, md_given = 0, md_only = 1;
+	unsigned int i;
+	size_t len;
+
+	while ((opt = getopt(argc, argv, "n:s:t:q:e:D:F:fCm:T:B:p:d:r:S:g:PA:M:V:HU:R:o:c")) != -1) {
+		switch (opt) {
+		case 'n':
+			conf.nr_files = atoi(optarg);
+			break;
+		case 's':
+			parse_file_size(optarg);
+			break;
+		case 't':
+			conf.nr_threads = atoi(optarg);
+			break;
+		case 'q':
+			conf.qdepth = atoi(optarg);
+			break;
+		case 'e':
+			for (i = 0; i < NR_ENGINES; i++)
+				if (strcmp(optarg, engine_name[i]) == 0)
+					break;
+			if (i == NR_ENGINES) {
+				err("unknown engine: %s", optarg);
+				usage(argv[0]);
+			}
+			conf.engine = i;
+			break;
+		case 'D':
+			parse_direct(optarg);
+			break;
+		case 'F':
+			parse_fsync(optarg);
+			break;
+		case 'f':
+			conf.fallocate = 1;
+			break;
+		case 'C':
+			conf.drop_cache = 1;
+			break;
+		case 'm':
+			conf.read_pct = atoi(optarg);
+			break;
+		case 'T':
+			conf.runtime = atof(optarg);
+			break;
+		case 'B':
+			conf.bytes = parse_size(optarg);
+			break;
+		case 'p':
+			parse_phases(optarg);
+			break;
+		case 'd':
+			parse_dist(optarg);
+			break;
+		case 'r':
+			conf.trace = optarg;
+			break;
+		case 'S':
+			conf.replay_speed = atof(optarg);
+			break;
+		case 'g':
+			conf.mmap_touch = atoi(optarg);
+			break;
+		case 'P':
+			conf.mmap_populate = 1;
+			break;
+		case 'A':
+			parse_advice(optarg);
+			break;
+		case 'M':
+			if (sscanf(optarg, "%dx%dx%d", &conf.md_width, &conf.md_depth,
+					&conf.md_files) != 3)
+				usage(argv[0]);
+			md_given = 1;
+			break;
+		case 'V':
+			conf.verify = 1;
+			conf.verify_seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			conf.perf_counters = 1;
+			break;
+		case 'U':
+			conf.server_pid = atoi(optarg);
+			break;
+		case 'R':
+			conf.nr_runs = atoi(optarg);
+			break;
+		case 'o':
+			conf.output = optarg;
+			len = strlen(optarg);
+			conf.output_json = len >= 5 && strcmp(optarg + len - 5, ".json") == 0;
+			break;
+		case 'c':
+			compare_mode = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (argc - optind != 2)
+		usage(argv[0]);
+	if (compare_mode)
+		return;
+	conf.dirname = argv[optind];
+	conf.req_size = atoi(argv[optind + 1]);
+
+	if (conf.nr_phases == 0 && conf.trace != NULL) {
+		conf.phases[0] = PHASE_CREATE;
+		conf.phases[1] = PHASE_REPLAY;
+		conf.phases[2] = PHASE_DELETE;
+		conf.nr_phases = 3;
+	} else if (conf.nr_phases == 0 && md_given) {
+		for (i = 0; i < sizeof(md_phases) / sizeof(md_phases[0]); i++)
+			conf.phases[i] = md_phases[i];
+		conf.nr_phases = i;
+	} else if (conf.nr_phases == 0) {
+		for (i = 0; i < sizeof(default_phases) / sizeof(default_phases[0]); i++)
+			conf.phases[i] = default_phases[i];
+		conf.nr_phases = i;
+	}
+
+	for (i = 0; i < (unsigned int)conf.nr_phases; i++) {
+		if (conf.phases[i] == PHASE_REPLAY && conf.trace == NULL) {
+			err("replay phase needs a trace (-r)");
+			usage(argv[0]);
+		}
+		if (!phase_is_md(conf.phases[i]))
+			md_only = 0;
+	}
+
+	if (conf.req_size <= 0 || conf.nr_files <= 0 || conf.nr_threads <= 0 ||
+		conf.qdepth <= 0 || conf.read_pct < 0 || conf.read_pct > 100 ||
+		conf.nr_runs <= 0 || conf.replay_speed < 0 ||
+		conf.mmap_touch < 0 || conf.md_width <= 0 || conf.md_depth < 0 || conf.md_files <= 0 ||
+		conf.runtime < 0 || conf.bytes < 0)
+		usage(argv[0]);
+
+	if (conf.verify && (conf.req_size < VERIFY_MIN_SIZE || conf.req_size % 8 != 0)) {
+		err("-V needs requests of at least %d bytes, multiple of 8", VERIFY_MIN_SIZE);
+		exit(1);
+	}
+
+	/* no thread without files, metadata phases have their own */
+	if (!md_only && conf.nr_threads > conf.nr_files)
+		conf.nr_threads = conf.nr_files;
 }
 
 /* Generates a unique (non-repeating) random number in O(1)
  *
- * pool_size is how many unique numbers are required to be generated.
- *
- * e.g.
- * The function get_next_rand_number(512) will initialize a pool of 512 random numbers (0 to 511)
- * and return a random number from it.
- * Subsequent calls to get_next_rand_number(-1) will return a unique random number from the pool
- * A call to get_next_rand_number(-1) will return -1 when the pool is exhausted
+ * shuffle_init(s, 512) initializes a pool of 512 numbers (0 to 511).
+ * Subsequent calls to shuffle_next(s) return a unique random number
+ * from the pool, and -1 when the pool is exhausted.
  *
  * Ref: http://stackoverflow.com/questions/196017/unique-non-repeating-random-numbers-in-o1
 */
-static int
-get_next_rand_number(int pool_size)
-{
-	int i, num, temp;
-	static int num_left = 0;
-	static int *num_pool = NULL;
-
-	/* Initialize a new pool */
-	if (pool_size >= 0) {
-		/* A pool already exists. Free it first */
-		if (num_pool != NULL) {
-			free(num_pool);
-			num_pool = NULL;
-		}
+static void
+shuffle_init(struct shuffle *s, long long pool_size)
+{
+	long long i;
 
-		/* Allocate memory */
-		num_pool = malloc(sizeof(int) * pool_size);
-		if (num_pool == NULL) {
-			err("malloc() failed: [%s]", strerror(errno));
-			exit(1);
-		}
+	/* A pool already exists. Free it first */
+	free(s->pool);
 
-		/* Initial values */
-		for (i = 0; i < pool_size; i++)
-			num_pool[i] = i;
-		num_left = pool_size;
+	/* Allocate memory */
+	s->pool = malloc(sizeof(long long) * pool_size);
+	if (s->pool == NULL) {
+		err("malloc() failed: [%s]", strerror(errno));
+		exit(1);
 	}
 
+	/* Initial values */
+	for (i = 0; i < pool_size; i++)
+		s->pool[i] = i;
+	s->left = pool_size;
+}
+
+static long long
+shuffle_next(struct shuffle *s, unsigned int *seed)
+{
+	long long num, temp;
+
 	/* pool exhausted, return -1 */
-	if (num_left == 0)
+	if (s->left == 0)
 		return -1;
 
-	/* select a random number between 0 and num_left */
-	num = rand() % num_left;
+	/* select a random number between 0 and left */
+	num = (((long long)rand_r(seed) << 31) | rand_r(seed)) % s->left;
 
-	/* replace num_pool[num] with num_pool[num_left - 1] */
-	temp = num_pool[num];
-	num_pool[num] = num_pool[num_left - 1];
+	/* replace pool[num] with pool[left - 1] */
+	temp = s->pool[num];
+	s->pool[num] = s->pool[s->left - 1];
 
 	/* decrement items left in pool */
-	num_left--;
+	s->left--;
 
-	/* if pool is exhausted, free memory */
-	if (num_left == 0) {
-		free(num_pool);
-		num_pool = NULL;
-	}
-
-	/* return previous num_pool[num] (saved in temp) */
+	/* return previous pool[num] (saved in temp) */
 	return temp;
 }
 
+/* uniform random number in [0, 1) */
+static double
+rand_u01(unsigned int *seed)
+{
+	/* 53 of 62 random bits, all a double can hold */
+	return ((((unsigned long long)rand_r(seed) << 31) | rand_r(seed)) >> 9) /
+		(double)(1ULL << 53);
+}
+
+/* Zipfian distributed ranks 0 (most popular) to n - 1
+ * Ref: J. Gray et al., Quickly Generating Billion-Record Synthetic
+ *      Databases, SIGMOD 1994
+ */
 static void
-file_create(void)
+zipf_init(struct zipf *z, long long n, double theta)
 {
-	int i, fd;
-	char filename[128];
+	long long i;
 
-	/* Create phase */
-	for (i = 0; i < NUMFILES; i++) {
-		snprintf(filename, 128, "%s/file-%d", dirname, i);
-		fd = open(filename, O_WRONLY | O_CREAT | O_EXCL,
-			S_IWUSR | S_IRUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-		if (fd == -1) {
-			err("open() failed: [%s]", strerror(errno));
-			exit(1);
-		}
-		close(fd);
+	z->n = n;
+	z->zetan = 0;
+	for (i = 1; i <= n; i++)
+		z->zetan += 1.0 / pow(i, theta);
+
+	z->alpha = 1.0 / (1.0 - theta);
+	z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) /
+		(1.0 - (1.0 + pow(0.5, theta)) / z->zetan);
+}
+
+static long long
+zipf_next(struct zipf *z, double theta, unsigned int *seed)
+{
+	double u = rand_u01(seed), uz = u * z->zetan;
+	long long rank;
+
+	if (uz < 1.0 || z->n < 2)
+		return 0;
+	if (uz < 1.0 + pow(0.5, theta))
+		return 1;
+
+	rank = z->n * pow(z->eta * u - z->eta + 1.0, z->alpha);
+	return rank < z->n ? rank : z->n - 1;
+}
+
+/* block of the next request in a random phase */
+static long long
+dist_next(struct job *job)
+{
+	long long hot, block;
+
+	switch (conf.dist) {
+	case DIST_ZIPF:
+		/* spread popular blocks over all files, the multiplier is a
+		 * prime above any block count, so this is a permutation
+		 */
+		block = zipf_next(&job->zipf, conf.zipf_theta, &job->seed);
+		return (unsigned long long)block * 2654435761ULL % job->nr_blocks;
+	case DIST_HOTSPOT:
+		/* hot blocks at the start of the job's first files */
+		hot = job->nr_blocks * conf.hot_pct / 100;
+		if (hot == 0)
+			hot = 1;
+		if (rand_u01(&job->seed) * 100 < conf.hot_access_pct || hot == job->nr_blocks)
+			return rand_u01(&job->seed) * hot;
+		return hot + rand_u01(&job->seed) * (job->nr_blocks - hot);
+	default:
+		return shuffle_next(&job->shuffle, &job->seed);
 	}
-	info("File Created ..");
 }
 
+/* picks file sizes from the configured distribution
+ * sizes are rounded up to a multiple of req_size
+ */
 static void
-file_delete(void)
+init_file_sizes(void)
 {
-	int i, ret;
-	char filename[128];
+	unsigned int seed = RAND_SEED;
+	double u;
+	off_t size;
+	int i;
+
+	file_size = malloc(sizeof(off_t) * conf.nr_files);
+	if (file_size == NULL) {
+		err("malloc() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < conf.nr_files; i++) {
+		u = (double)rand_r(&seed) / RAND_MAX;
+		if (conf.size_min == conf.size_max)
+			size = conf.size_min;
+		else if (conf.size_log)
+			size = exp(log(conf.size_min) +
+				u * (log(conf.size_max) - log(conf.size_min)));
+		else
+			size = conf.size_min + u * (conf.size_max - conf.size_min);
 
-	/* Unlink phase */
-	for (i = 0; i < NUMFILES; i++) {
-		snprintf(filename, 128, "%s/file-%d", dirname, i);
-		ret = unlink(filename);
-		if (ret == -1) {
-			err("unlink() failed: [%s]", strerror(errno));
+		size = (size + conf.req_size - 1) / conf.req_size * conf.req_size;
+		file_size[i] = size;
+	}
+}
+
+/* spreads files over jobs, file i belongs to job (i % nr_threads) */
+static void
+init_jobs(void)
+{
+	char root[PATH_MAX];
+	struct job *job;
+	int i, j;
+
+	jobs = calloc(conf.nr_threads, sizeof(struct job));
+	if (jobs == NULL) {
+		err("calloc() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < conf.nr_threads; i++) {
+		job = &jobs[i];
+		job->id = i;
+		job->nr_files = (conf.nr_files - i + conf.nr_threads - 1) / conf.nr_threads;
+		job->files = malloc(sizeof(int) * job->nr_files);
+		job->fds = malloc(sizeof(int) * job->nr_files);
+		job->maps = calloc(job->nr_files, sizeof(char *));
+		job->first_block = malloc(sizeof(long long) * (job->nr_files + 1));
+		if (job->files == NULL || job->fds == NULL || job->maps == NULL ||
+			job->first_block == NULL) {
+			err("malloc() failed: [%s]", strerror(errno));
 			exit(1);
 		}
+
+		job->first_block[0] = 0;
+		for (j = 0; j < job->nr_files; j++) {
+			job->files[j] = i + j * conf.nr_threads;
+			job->fds[j] = -1;
+			job->first_block[j + 1] = job->first_block[j] +
+				file_size[job->files[j]] / conf.req_size;
+		}
+		job->nr_blocks = job->first_block[job->nr_files];
+		if (conf.verify) {
+			job->gen = calloc(job->nr_blocks + 1, sizeof(uint32_t));
+			if (job->gen == NULL) {
+				err("calloc() failed: [%s]", strerror(errno));
+				exit(1);
+			}
+		}
+		if (conf.dist == DIST_ZIPF)
+			zipf_init(&job->zipf, job->nr_blocks, conf.zipf_theta);
+
+		pthread_mutex_init(&job->lock, NULL);
+		job->seed = RAND_SEED + i;
+
+		snprintf(root, sizeof(root), "%s/md-%d", conf.dirname, i);
+		md_tree_init(&job->md, root, conf.md_width, conf.md_depth, conf.md_files);
 	}
 }
 
+/* hands each request of the trace to the job owning its file */
 static void
-file_write_sequential(void)
+init_trace(void)
 {
-	int i, j, fd;
-	char filename[128], *buf;
-	ssize_t bytes_written;
+	struct trace_rec *recs, *rec;
+	struct job *job;
+	long long nr, i;
+
+	if (conf.trace == NULL)
+		return;
 
-	buf = memalign((size_t)req_size, (size_t)req_size);
-	if (buf == NULL) {
-		err("Failed to allocate buffer");
+	nr = trace_load(conf.trace, &recs);
+	if (nr < 0)
 		exit(1);
+
+	for (i = 0; i < nr; i++) {
+		if (recs[i].file >= conf.nr_files) {
+			err("trace uses file %d, only %d files (-n)", recs[i].file, conf.nr_files);
+			exit(1);
+		}
+		jobs[recs[i].file % conf.nr_threads].nr_trace++;
+		if (recs[i].size > trace_max_size)
+			trace_max_size = recs[i].size;
 	}
 
-	for (i = 0; i < NUMFILES; i++) {
-		snprintf(filename, 128, "%s/file-%d", dirname, i);
-		fd = open(filename, O_DIRECT | O_WRONLY |  O_EXCL,
-			S_IWUSR | S_IRUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-		if (fd == -1) {
-			err("open() failed: [%s]", strerror(errno));
-			free(buf);
+	for (i = 0; i < conf.nr_threads; i++) {
+		jobs[i].trace = malloc(sizeof(struct trace_rec) * (jobs[i].nr_trace + 1));
+		if (jobs[i].trace == NULL) {
+			err("malloc() failed: [%s]", strerror(errno));
 			exit(1);
 		}
-		info("File Opened Sequential Write ..");
-
-		/* It is possible for write() to return a value > 0 and < req_size,
-		 * e.g. if there is insufficient space on the underlying physical medium
-		 * refer: http://linux.die.net/man/2/write
-		 *
-		 * However, no effort has been made to handle that case since this template
-		 * is provided as-is in assignment. So, we assume every call to write() will
-		 * either flush req_size bytes or fail.
-		 * Also, it is assumed that req_size, buf & current file offset are suitably aligned.
-		 * e.g. if req_size is passed as 1023, write() will fail with EINVAL
-		*/
-		for (j = 0; j < FILESIZE; j += req_size) {
-			bytes_written = write(fd, buf, req_size);
-			if (bytes_written == -1) {
-				err("write() failed: [%s]", strerror(errno));
-				free(buf);
-				close(fd);
+		jobs[i].nr_trace = 0;
+	}
+
+	/* file i is the job's (i / nr_threads)'th file, see init_jobs() */
+	for (i = 0; i < nr; i++) {
+		job = &jobs[recs[i].file % conf.nr_threads];
+		rec = &job->trace[job->nr_trace++];
+		*rec = recs[i];
+		rec->file = recs[i].file / conf.nr_threads;
+	}
+	free(recs);
+}
+
+/* every file stays open through a read/write phase */
+static void
+raise_file_limit(void)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		return;
+	if (rlim.rlim_cur < (rlim_t)conf.nr_files + 64) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+}
+
+static void
+file_name(char *filename, int file)
+{
+	snprintf(filename, PATH_MAX, "%s/file-%d", conf.dirname, file);
+}
+
+static int
+phase_is_io(enum phase_type type)
+{
+	return type != PHASE_CREATE && type != PHASE_DELETE && !phase_is_md(type);
+}
+
+static int
+phase_is_random(enum phase_type type)
+{
+	return type == PHASE_RAND_WRITE || type == PHASE_RAND_READ ||
+		type == PHASE_MIXED || type == PHASE_MMAP_RAND_WRITE ||
+		type == PHASE_MMAP_RAND_READ;
+}
+
+static int
+phase_is_mmap(enum phase_type type)
+{
+	return type >= PHASE_MMAP_SEQ_WRITE && type <= PHASE_MMAP_RAND_READ;
+}
+
+static void
+open_files(struct phase *ph)
+{
+	char filename[PATH_MAX];
+	int i, j, flags;
+
+	switch (ph->type) {
+	case PHASE_SEQ_WRITE:
+	case PHASE_RAND_WRITE:
+		flags = O_WRONLY;
+		break;
+	case PHASE_MIXED:
+	case PHASE_REPLAY: /* traced requests need not be aligned */
+	case PHASE_MMAP_SEQ_WRITE: /* PROT_WRITE needs a readable fd */
+	case PHASE_MMAP_RAND_WRITE:
+		flags = O_RDWR;
+		break;
+	default:
+		flags = O_RDONLY;
+	}
+
+	/* native AIO only is asynchronous for direct I/O */
+	if (conf.direct_phases & (1 << ph->type) ||
+		(conf.engine == ENGINE_AIO && ph->type != PHASE_REPLAY &&
+		 !phase_is_mmap(ph->type)))
+		flags |= O_DIRECT;
+
+	for (i = 0; i < conf.nr_threads; i++) {
+		for (j = 0; j < jobs[i].nr_files; j++) {
+			file_name(filename, jobs[i].files[j]);
+			jobs[i].fds[j] = open(filename, flags);
+			if (jobs[i].fds[j] == -1) {
+				err("open() failed: [%s]", strerror(errno));
 				exit(1);
 			}
 		}
+	}
+}
 
-		close(fd);
+/* maps every file of every job, write phases grow files to their size
+ * Counted in phase time, as MAP_POPULATE faults pages in here.
+ */
+static void
+map_files(struct phase *ph)
+{
+	int write_op, prot, flags, i, j;
+	struct stat st;
+	off_t size;
+
+	write_op = ph->type == PHASE_MMAP_SEQ_WRITE || ph->type == PHASE_MMAP_RAND_WRITE;
+	prot = write_op ? PROT_READ | PROT_WRITE : PROT_READ;
+	flags = MAP_SHARED | (conf.mmap_populate ? MAP_POPULATE : 0);
+
+	for (i = 0; i < conf.nr_threads; i++) {
+		for (j = 0; j < jobs[i].nr_files; j++) {
+			size = file_size[jobs[i].files[j]];
+			if (fstat(jobs[i].fds[j], &st) == -1) {
+				err("fstat() failed: [%s]", strerror(errno));
+				exit(1);
+			}
+
+			/* touching beyond end of file raises SIGBUS */
+			if (st.st_size < size && write_op &&
+				ftruncate(jobs[i].fds[j], size) == -1) {
+				err("ftruncate() failed: [%s]", strerror(errno));
+				exit(1);
+			} else if (st.st_size < size && !write_op) {
+				err("file-%d is %lld bytes, expected %lld (run a write phase first)",
+					jobs[i].files[j], (long long)st.st_size, (long long)size);
+				exit(1);
+			}
+
+			jobs[i].maps[j] = mmap(NULL, size, prot, flags, jobs[i].fds[j], 0);
+			if (jobs[i].maps[j] == MAP_FAILED) {
+				err("mmap() failed: [%s]", strerror(errno));
+				exit(1);
+			}
+			if (conf.mmap_advice != MADV_NORMAL &&
+				madvise(jobs[i].maps[j], size, conf.mmap_advice) == -1) {
+				err("madvise() failed: [%s]", strerror(errno));
+				exit(1);
+			}
+		}
 	}
-	free(buf);
 }
 
+/* writes dirty pages back, also counted in phase time */
 static void
-file_read_sequential(void)
+unmap_files(struct phase *ph)
 {
-	int i, fd;
-	char filename[128], *buf;
-	ssize_t bytes_read;
+	off_t size;
+	int i, j;
 
-	if ((FILESIZE % req_size) != 0) {
-		err("FILESIZE(%d) and req_size(%d) are not aligned",
-			FILESIZE, req_size);
-		exit(1);
+	for (i = 0; i < conf.nr_threads; i++) {
+		for (j = 0; j < jobs[i].nr_files; j++) {
+			size = file_size[jobs[i].files[j]];
+			if ((ph->type == PHASE_MMAP_SEQ_WRITE ||
+				 ph->type == PHASE_MMAP_RAND_WRITE) &&
+				msync(jobs[i].maps[j], size, MS_SYNC) == -1) {
+				err("msync() failed: [%s]", strerror(errno));
+				exit(1);
+			}
+			munmap(jobs[i].maps[j], size);
+			jobs[i].maps[j] = NULL;
+		}
 	}
+}
 
-	buf = memalign((size_t)req_size, (size_t)req_size);
-	if (buf == NULL) {
-		err("Failed to allocate buffer");
-		exit(1);
+/* makes writes of the phase durable, counted in phase time */
+static void
+sync_files(void)
+{
+	int i, j;
+
+	for (i = 0; i < conf.nr_threads; i++) {
+		for (j = 0; j < jobs[i].nr_files; j++) {
+			if (fsync(jobs[i].fds[j]) == -1) {
+				err("fsync() failed: [%s]", strerror(errno));
+				exit(1);
+			}
+		}
 	}
+}
 
-	for (i = 0; i < NUMFILES; i++) {
-		snprintf(filename, 128, "%s/file-%d", dirname, i);
+/* starts the next phase cold: dirty pages are written back first,
+ * as DONTNEED leaves them in the page cache
+ * A FUSE daemon's own cache (e.g. the bbfs buffer) is not affected.
+ */
+static void
+drop_caches(void)
+{
+	char filename[PATH_MAX];
+	int i, fd;
+
+	for (i = 0; i < conf.nr_files; i++) {
+		file_name(filename, i);
 		fd = open(filename, O_RDONLY);
+		if (fd == -1 && errno == ENOENT)
+			continue;
 		if (fd == -1) {
 			err("open() failed: [%s]", strerror(errno));
-			free(buf);
 			exit(1);
 		}
-		info("File Opened Sequential Read ..");
-
-		do {
-			/* read chunks of req_size bytes */
-			bytes_read = read(fd, buf, req_size);
-			if (bytes_read == -1) {
-				err("read() failed: [%s]", strerror(errno));
-				free(buf);
-				close(fd);
-				exit(1);
-			}
-		/* read until EOF is reached */
-		} while (bytes_read != 0);
-
+		if (fdatasync(fd) == -1 ||
+			(errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) != 0) {
+			err("dropping file-%d from page cache failed: [%s]", i,
+				strerror(errno));
+			exit(1);
+		}
 		close(fd);
 	}
-	free(buf);
 }
 
 static void
-file_write_random(void)
+close_files(void)
+{
+	int i, j;
+
+	for (i = 0; i < conf.nr_threads; i++) {
+		for (j = 0; j < jobs[i].nr_files; j++) {
+			close(jobs[i].fds[j]);
+			jobs[i].fds[j] = -1;
+		}
+	}
+}
+
+/* sets the job up for a new pass over its files */
+static void
+job_rewind(struct job *job, struct phase *ph)
+{
+	job->cursor = 0;
+	if (phase_is_random(ph->type) && conf.dist == DIST_UNIFORM)
+		shuffle_init(&job->shuffle, job->nr_blocks);
+}
+
+/* next request of 'job', -1 when phase is over
+ * create/delete phases count files, replay phase trace records,
+ * other phases blocks. Random phases with a skewed distribution
+ * draw as many blocks per pass as there are, with repetition.
+ */
+static long long
+job_next(struct job *job, struct phase *ph)
 {
-	int i, offset, fd;
-	char filename[128], *buf;
-	ssize_t bytes_written;
+	long long next, total;
+	int pass;
 
-	if ((FILESIZE % req_size) != 0) {
-		err("FILESIZE(%d) and req_size(%d) are not aligned",
-			FILESIZE, req_size);
+	if (ph->type == PHASE_REPLAY)
+		total = job->nr_trace;
+	else if (phase_is_md(ph->type))
+		total = md_nr_requests(&job->md, ph->type);
+	else
+		total = phase_is_io(ph->type) ? job->nr_blocks : job->nr_files;
+
+	pthread_mutex_lock(&job->lock);
+	for (pass = 0; pass < 2; pass++) {
+		if (phase_is_random(ph->type) && conf.dist == DIST_UNIFORM)
+			next = shuffle_next(&job->shuffle, &job->seed);
+		else if (phase_is_random(ph->type))
+			next = job->cursor < total ? (job->cursor++, dist_next(job)) : -1;
+		else
+			next = job->cursor < total ? job->cursor++ : -1;
+
+		/* bounded phases go round again */
+		if (next >= 0 || !ph->bounded || total == 0)
+			break;
+		job_rewind(job, ph);
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	return next;
+}
+
+/* returns 1 if runtime or bytes limit of phase is reached */
+static int
+phase_limit_reached(struct phase *ph)
+{
+	struct timespec now;
+
+	if (ph->stop)
+		return 1;
+
+	if (conf.runtime > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > ph->deadline.tv_sec ||
+			(now.tv_sec == ph->deadline.tv_sec &&
+			 now.tv_nsec >= ph->deadline.tv_nsec))
+			ph->stop = 1;
+	}
+
+	if (conf.bytes > 0 &&
+		__sync_add_and_fetch(&ph->bytes_issued, conf.req_size) > conf.bytes)
+		ph->stop = 1;
+
+	return ph->stop;
+}
+
+static void
+do_create(int file)
+{
+	char filename[PATH_MAX];
+	int fd;
+
+	file_name(filename, file);
+	fd = open(filename, O_WRONLY | O_CREAT | O_EXCL,
+		S_IWUSR | S_IRUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (fd == -1) {
+		err("open() failed: [%s]", strerror(errno));
 		exit(1);
 	}
 
-	buf = memalign((size_t)req_size, (size_t)req_size);
-	if (buf == NULL) {
-		err("Failed to allocate buffer");
+	/* write phases then overwrite allocated blocks instead of growing files */
+	if (conf.fallocate && fallocate(fd, 0, 0, file_size[file]) == -1) {
+		err("fallocate() failed: [%s]", strerror(errno));
 		exit(1);
 	}
+	close(fd);
+}
 
-	for (i = 0; i < NUMFILES; i++) {
-		snprintf(filename, 128, "%s/file-%d", dirname, i);
-		fd = open(filename, O_DIRECT | O_WRONLY | O_EXCL,
-			S_IWUSR | S_IRUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-		if (fd == -1) {
-			err("open() failed: [%s]", strerror(errno));
-			free(buf);
+/* with -F <n>, a worker's every n'th write is followed by fsync() of its
+ * file, counted in the latency of that write
+ */
+static void
+fsync_write(struct worker *w, int fd)
+{
+	if (conf.fsync_ops == 0 || ++w->unsynced < conf.fsync_ops)
+		return;
+
+	w->unsynced = 0;
+	if (fsync(fd) == -1) {
+		err("fsync() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+}
+
+static void
+do_delete(int file)
+{
+	char filename[PATH_MAX];
+
+	file_name(filename, file);
+	if (unlink(filename) == -1) {
+		err("unlink() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+}
+
+/* index of the job's file holding 'block', its offset in 'offset' */
+static int
+locate_block(struct job *job, long long block, off_t *offset)
+{
+	int lo = 0, hi = job->nr_files - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (job->first_block[mid] <= block)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	*offset = (block - job->first_block[lo]) * conf.req_size;
+
+	return lo;
+}
+
+/* returns 1 if requests of phase type 'type' may write */
+static int
+phase_writes(enum phase_type type)
+{
+	return type == PHASE_SEQ_WRITE || type == PHASE_RAND_WRITE ||
+		type == PHASE_MIXED || type == PHASE_REPLAY ||
+		type == PHASE_MMAP_SEQ_WRITE || type == PHASE_MMAP_RAND_WRITE;
+}
+
+/* returns 1 if next request of 'w' is a write */
+static int
+next_is_write(struct worker *w)
+{
+	switch (w->phase->type) {
+	case PHASE_SEQ_WRITE:
+	case PHASE_RAND_WRITE:
+	case PHASE_MMAP_SEQ_WRITE:
+	case PHASE_MMAP_RAND_WRITE:
+		return 1;
+	case PHASE_MIXED:
+		return rand_r(&w->seed) % 100 >= conf.read_pct;
+	default:
+		return 0;
+	}
+}
+
+/* checks block 'block' of the job, 'len' bytes read into 'buf'
+ * 'min_gen' is the generation of the block when the read was issued.
+ */
+static void
+verify_block(struct worker *w, long long block, char *buf, ssize_t len,
+	uint32_t min_gen)
+{
+	struct job *job = w->job;
+	char why[128];
+	off_t offset;
+	int lo, retry;
+
+	if (min_gen == GEN_NONE || min_gen == GEN_UNKNOWN)
+		return;
+
+	lo = locate_block(job, block, &offset);
+	for (retry = 0; ; retry++) {
+		if (len == conf.req_size &&
+			verify_check(buf, len, job->files[lo], offset, min_gen,
+				why, sizeof(why)) == 0)
+			return;
+		if (len != conf.req_size)
+			snprintf(why, sizeof(why), "short read (%zd bytes)", len);
+
+		/* only mixed phases read blocks other workers are writing */
+		if (retry == VERIFY_RETRIES || w->phase->type != PHASE_MIXED)
+			break;
+		len = pread(job->fds[lo], buf, conf.req_size, offset);
+	}
+
+	if (__sync_add_and_fetch(&w->phase->mismatches, 1) <= MAX_MISMATCH_REPORTS)
+		err("verify: file-%d offset %lld: %s", job->files[lo],
+			(long long)offset, why);
+}
+
+/* one request of req_size bytes at block 'block' of the job
+ *
+ * It is possible for write() to return a value > 0 and < req_size,
+ * e.g. if there is insufficient space on the underlying physical medium.
+ * As in the original benchmark, we assume every write either flushes
+ * req_size bytes or fails. Short reads only happen at end of file.
+ */
+static void
+do_io(struct worker *w, long long block)
+{
+	struct job *job = w->job;
+	uint32_t min_gen = GEN_NONE;
+	ssize_t ret;
+	off_t offset;
+	int lo, write_op;
+
+	lo = locate_block(job, block, &offset);
+	write_op = next_is_write(w);
+
+	if (conf.verify && write_op)
+		verify_fill(w->buf, conf.req_size, job->files[lo], offset, w->phase->gen);
+	else if (conf.verify)
+		min_gen = job->gen[block];
+
+	if (write_op)
+		ret = pwrite(job->fds[lo], w->buf, conf.req_size, offset);
+	else
+		ret = pread(job->fds[lo], w->buf, conf.req_size, offset);
+
+	if (ret == -1) {
+		err("%s() failed: [%s]", write_op ? "write" : "read", strerror(errno));
+		exit(1);
+	}
+
+	if (write_op)
+		fsync_write(w, job->fds[lo]);
+
+	if (conf.verify && write_op)
+		job->gen[block] = w->phase->gen;
+	else if (conf.verify)
+		verify_block(w, block, w->buf, ret, min_gen);
+
+	w->ops++;
+	w->bytes += ret;
+}
+
+/* one request through the file's mapping
+ * Touching one byte per page faults every page of the request in (or
+ * dirties it), copying moves the data like read()/write() would.
+ */
+static void
+do_mmap(struct worker *w, long long block)
+{
+	struct job *job = w->job;
+	volatile char *addr;
+	uint32_t min_gen;
+	off_t offset;
+	int lo, write_op, i;
+
+	lo = locate_block(job, block, &offset);
+	write_op = next_is_write(w);
+	addr = job->maps[lo] + offset;
+
+	/* only whole block copies can be verified */
+	if (conf.mmap_touch == 0 && write_op) {
+		if (conf.verify)
+			verify_fill(w->buf, conf.req_size, job->files[lo], offset,
+				w->phase->gen);
+		memcpy((char *)addr, w->buf, conf.req_size);
+		if (conf.verify)
+			job->gen[block] = w->phase->gen;
+	} else if (conf.mmap_touch == 0) {
+		min_gen = conf.verify ? job->gen[block] : GEN_NONE;
+		memcpy(w->buf, (char *)addr, conf.req_size);
+		if (conf.verify)
+			verify_block(w, block, w->buf, conf.req_size, min_gen);
+	} else if (write_op) {
+		for (i = 0; i < conf.req_size; i += conf.mmap_touch)
+			addr[i] = (char)i;
+		if (conf.verify)
+			job->gen[block] = GEN_UNKNOWN;
+	} else {
+		for (i = 0; i < conf.req_size; i += conf.mmap_touch)
+			w->buf[0] += addr[i];
+	}
+
+	/* fsync() also writes back pages dirtied through mappings */
+	if (write_op)
+		fsync_write(w, job->fds[lo]);
+
+	w->ops++;
+	w->bytes += conf.req_size;
+}
+
+/* blocks of job file 'file' overlapping [offset, offset + len) */
+static void
+unstamp_range(struct job *job, int file, off_t offset, size_t len)
+{
+	long long block, last;
+
+	block = job->first_block[file] + offset / conf.req_size;
+	last = job->first_block[file] + (offset + len - 1) / conf.req_size;
+	if (last >= job->first_block[file + 1])
+		last = job->first_block[file + 1] - 1;
+
+	for (; block <= last; block++)
+		job->gen[block] = GEN_UNKNOWN;
+}
+
+/* sleeps until trace record 'rec' is due */
+static void
+replay_wait(struct phase *ph, struct trace_rec *rec)
+{
+	struct timespec due;
+	uint64_t nsec;
+
+	if (conf.replay_speed == 0)
+		return;
+
+	nsec = ph->start_nsec + rec->time / conf.replay_speed;
+	due.tv_sec = nsec / 1000000000;
+	due.tv_nsec = nsec % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+		;
+}
+
+static void
+do_replay(struct worker *w, struct trace_rec *rec)
+{
+	int fd = w->job->fds[rec->file];
+	ssize_t ret;
+
+	if (rec->write)
+		ret = pwrite(fd, w->buf, rec->size, rec->offset);
+	else
+		ret = pread(fd, w->buf, rec->size, rec->offset);
+
+	if (ret == -1) {
+		err("%s() failed: [%s]", rec->write ? "write" : "read", strerror(errno));
+		exit(1);
+	}
+
+	if (rec->write)
+		fsync_write(w, fd);
+
+	/* replayed writes do not carry block stamps */
+	if (conf.verify && rec->write && ret > 0)
+		unstamp_range(w->job, rec->file, rec->offset, ret);
+
+	w->ops++;
+	w->bytes += ret;
+}
+
+/* next trace record of the files pinned to 'w', -1 when phase is over
+ * The job's records are in trace order and a file's records all go to
+ * the same worker, so each file sees its requests in trace order.
+ */
+static long long
+replay_next(struct worker *w)
+{
+	struct job *job = w->job;
+
+	for (; w->cursor < job->nr_trace; w->cursor++)
+		if (job->trace[w->cursor].file % conf.qdepth == w->lane)
+			return w->cursor++;
+
+	return -1;
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct phase *ph = w->phase;
+	long long next;
+	uint64_t start;
+
+	pthread_barrier_wait(&ph->start);
+
+	while (!(phase_is_io(ph->type) && phase_limit_reached(ph))) {
+		if (ph->type == PHASE_REPLAY)
+			next = replay_next(w);
+		else
+			next = job_next(w->job, ph);
+		if (next < 0)
+			break;
+
+		if (ph->type == PHASE_REPLAY)
+			replay_wait(ph, &w->job->trace[next]);
+
+		start = gettimensec();
+		switch (ph->type) {
+		case PHASE_CREATE:
+			do_create(w->job->files[next]);
+			w->ops++;
+			break;
+		case PHASE_DELETE:
+			do_delete(w->job->files[next]);
+			w->ops++;
+			break;
+		case PHASE_REPLAY:
+			do_replay(w, &w->job->trace[next]);
+			break;
+		default:
+			if (phase_is_md(ph->type)) {
+				md_do(&w->job->md, ph->type, next);
+				w->ops++;
+			} else if (phase_is_mmap(ph->type)) {
+				do_mmap(w, next);
+			} else {
+				do_io(w, next);
+			}
+		}
+		hist_add(&w->hist, gettimensec() - start);
+	}
+
+	return NULL;
+}
+
+/* I/O phases with the aio engine
+ * Keeps up to 'qdepth' requests submitted, each with its own slot of
+ * w->buf; latency is measured from io_submit() to io_getevents().
+ */
+static void *
+aio_worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct phase *ph = w->phase;
+	struct job *job = w->job;
+	aio_context_t ctx = 0;
+	struct iocb *iocbs, **submit;
+	struct io_event *events;
+	uint64_t *issued, now;
+	long long *slot_block; /* block of request in slot */
+	uint32_t *slot_gen; /* generation of block when read was issued */
+	int *free_slots, nr_free, nr_submit, inflight = 0, done = 0;
+	int i, ret, slot, lo, write_op;
+	off_t offset;
+	long long next;
+
+	iocbs = calloc(conf.qdepth, sizeof(struct iocb));
+	submit = calloc(conf.qdepth, sizeof(struct iocb *));
+	events = calloc(conf.qdepth, sizeof(struct io_event));
+	issued = calloc(conf.qdepth, sizeof(uint64_t));
+	free_slots = calloc(conf.qdepth, sizeof(int));
+	slot_block = calloc(conf.qdepth, sizeof(long long));
+	slot_gen = calloc(conf.qdepth, sizeof(uint32_t));
+	if (iocbs == NULL || submit == NULL || events == NULL || issued == NULL ||
+		free_slots == NULL || slot_block == NULL || slot_gen == NULL) {
+		err("calloc() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+	for (i = 0; i < conf.qdepth; i++)
+		free_slots[i] = i;
+	nr_free = conf.qdepth;
+
+	if (io_setup(conf.qdepth, &ctx) < 0) {
+		err("io_setup() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+
+	pthread_barrier_wait(&ph->start);
+
+	for (;;) {
+		/* refill the queue */
+		nr_submit = 0;
+		while (!done && nr_free > 0) {
+			if (phase_limit_reached(ph) || (next = job_next(job, ph)) < 0) {
+				done = 1;
+				break;
+			}
+
+			slot = free_slots[--nr_free];
+			lo = locate_block(job, next, &offset);
+			write_op = next_is_write(w);
+
+			slot_block[slot] = next;
+			if (conf.verify && write_op)
+				verify_fill(w->buf + (size_t)slot * conf.req_size, conf.req_size,
+					job->files[lo], offset, ph->gen);
+			else if (conf.verify)
+				slot_gen[slot] = job->gen[next];
+
+			memset(&iocbs[slot], 0, sizeof(struct iocb));
+			iocbs[slot].aio_data = slot;
+			iocbs[slot].aio_lio_opcode = write_op ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+			iocbs[slot].aio_fildes = job->fds[lo];
+			iocbs[slot].aio_buf = (uintptr_t)(w->buf + (size_t)slot * conf.req_size);
+			iocbs[slot].aio_nbytes = conf.req_size;
+			iocbs[slot].aio_offset = offset;
+			submit[nr_submit++] = &iocbs[slot];
+		}
+
+		if (nr_submit > 0) {
+			now = gettimensec();
+			for (i = 0; i < nr_submit; i++)
+				issued[submit[i]->aio_data] = now;
+
+			ret = io_submit(ctx, nr_submit, submit);
+			if (ret != nr_submit) {
+				err("io_submit() failed: [%s]",
+					ret < 0 ? strerror(errno) : "partial submit");
+				exit(1);
+			}
+			inflight += nr_submit;
+		}
+
+		if (inflight == 0)
+			break;
+
+		ret = io_getevents(ctx, 1, inflight, events, NULL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err("io_getevents() failed: [%s]", strerror(errno));
 			exit(1);
 		}
-		info("File Opened Random Write ..");
-
-		/* randomly get an offset for lseek() */
-		offset = get_next_rand_number((FILESIZE / req_size));
-		while (offset >= 0) {
-			/* seek from beginning of file */
-			lseek(fd, (offset * req_size), SEEK_SET);
-
-			/* at every random offset, flush req_size bytes of data
-			*
-			* As noted in file_write_sequential(), it is assumed that write()
-			* will either flush whole req_size bytes of data or none at all.
-			* The case where physical medium is full & there is not enough space
-			* is not handled
-			*/
-			bytes_written = write(fd, buf, req_size);
-			if (bytes_written == -1) {
-				err("write() failed: [%s]", strerror(errno));
-				free(buf);
-				close(fd);
+
+		now = gettimensec();
+		for (i = 0; i < ret; i++) {
+			slot = events[i].data;
+			if ((long long)events[i].res < 0) {
+				err("%s failed: [%s]",
+					iocbs[slot].aio_lio_opcode == IOCB_CMD_PWRITE ? "write" : "read",
+					strerror(-(long long)events[i].res));
 				exit(1);
 			}
+			if (iocbs[slot].aio_lio_opcode == IOCB_CMD_PWRITE) {
+				fsync_write(w, iocbs[slot].aio_fildes);
+				now = gettimensec();
+			}
+			hist_add(&w->hist, now - issued[slot]);
+
+			if (conf.verify && iocbs[slot].aio_lio_opcode == IOCB_CMD_PWRITE)
+				job->gen[slot_block[slot]] = ph->gen;
+			else if (conf.verify)
+				verify_block(w, slot_block[slot],
+					w->buf + (size_t)slot * conf.req_size, events[i].res,
+					slot_gen[slot]);
 
-			/* generate another random offset */
-			offset = get_next_rand_number(-1);
+			w->ops++;
+			w->bytes += events[i].res;
+			free_slots[nr_free++] = slot;
 		}
-		close(fd);
+		inflight -= ret;
 	}
-	free(buf);
+
+	io_destroy(ctx);
+	free(iocbs);
+	free(submit);
+	free(events);
+	free(issued);
+	free(free_slots);
+	free(slot_block);
+	free(slot_gen);
+
+	return NULL;
 }
 
 static void
-file_read_random(void)
+run_phase(struct phase *ph)
 {
-	int i, fd, offset;
-	char filename[128], *buf;
-	ssize_t total_bytes, bytes_read;
+	static uint32_t last_gen;
+	struct worker *workers;
+	int i, nr_workers, use_aio, nr_bufs;
+	size_t buf_size = conf.req_size;
+	struct cpu_usage cpu_start;
+	void *(*func)(void *);
+	long start;
 
-	if ((FILESIZE % req_size) != 0) {
-		err("FILESIZE(%d) and req_size(%d) are not aligned",
-			FILESIZE, req_size);
-		exit(1);
+	/* replay requests vary in size & alignment, mmap has no requests
+	 * to submit, both always synchronous
+	 */
+	use_aio = phase_is_io(ph->type) && conf.engine == ENGINE_AIO &&
+		ph->type != PHASE_REPLAY && !phase_is_mmap(ph->type);
+	if (ph->type == PHASE_REPLAY && trace_max_size > buf_size)
+		buf_size = trace_max_size;
+	if (use_aio) {
+		nr_workers = conf.nr_threads;
+		nr_bufs = conf.qdepth;
+		func = aio_worker_main;
+	} else {
+		nr_workers = conf.nr_threads * (phase_is_io(ph->type) ? conf.qdepth : 1);
+		nr_bufs = 1;
+		func = worker_main;
 	}
-
-	buf = memalign((size_t)req_size, (size_t)req_size);
-	if (buf == NULL) {
-		err("Failed to allocate buffer");
+	workers = calloc(nr_workers, sizeof(struct worker));
+	if (workers == NULL) {
+		err("calloc() failed: [%s]", strerror(errno));
 		exit(1);
 	}
 
-	for (i = 0; i < NUMFILES; i++) {
-		snprintf(filename, 128, "%s/file-%d", dirname, i);
-		fd = open(filename, O_RDONLY);
-		if (fd == -1) {
-			err("open() failed: [%s]", strerror(errno));
-			free(buf);
+	/* a trace is replayed once, limits only cut it short */
+	ph->bounded = phase_is_io(ph->type) && ph->type != PHASE_REPLAY &&
+		(conf.runtime > 0 || conf.bytes > 0);
+	pthread_barrier_init(&ph->start, NULL, nr_workers + 1);
+
+	/* later phases stamp later generations, files start out unwritten */
+	ph->gen = ++last_gen;
+	if (conf.verify && (ph->type == PHASE_CREATE || ph->type == PHASE_DELETE))
+		for (i = 0; i < conf.nr_threads; i++)
+			memset(jobs[i].gen, 0, sizeof(uint32_t) * jobs[i].nr_blocks);
+
+	if (phase_is_io(ph->type) && conf.drop_cache)
+		drop_caches();
+	if (phase_is_io(ph->type))
+		open_files(ph);
+	for (i = 0; i < conf.nr_threads; i++)
+		job_rewind(&jobs[i], ph);
+
+	for (i = 0; i < nr_workers; i++) {
+		workers[i].job = &jobs[i % conf.nr_threads];
+		workers[i].phase = ph;
+		workers[i].seed = RAND_SEED + i;
+		workers[i].lane = i / conf.nr_threads;
+		workers[i].buf = memalign((size_t)conf.req_size, buf_size * nr_bufs);
+		if (workers[i].buf == NULL) {
+			err("Failed to allocate buffer");
 			exit(1);
 		}
-		info("File Opened Random Read ..");
-
-		/* randomly get an offset for lseek() */
-		offset = get_next_rand_number((FILESIZE / req_size));
-		while (offset >= 0) {
-			/* seek from beginning of file */
-			lseek(fd, (offset * req_size), SEEK_SET);
-
-			total_bytes = 0;
-			do {
-				bytes_read = read(fd, buf, req_size);
-				if (bytes_read == -1) {
-					err("read() failed: [%s]", strerror(errno));
-					free(buf);
-					close(fd);
-					exit(1);
-				}
-
-				/* at every random offset, read req_size bytes of data
-				*
-				* In case read() is not able to read whole req_size bytes,
-				* we retry to read until total_bytes for the current random offset
-				* reach req_size. This is best effort basis to sequentially
-				* read the whole file.
-				*/
-				total_bytes += bytes_read;
-			} while (total_bytes != req_size);
-
-			/* generate another random offset */
-			offset = get_next_rand_number(-1);
+		memset(workers[i].buf, 0, buf_size * nr_bufs);
+		hist_init(&workers[i].hist);
+
+		if (pthread_create(&workers[i].thread, NULL, func, &workers[i]) != 0) {
+			err("pthread_create() failed");
+			exit(1);
+		}
+	}
+
+	cpu_sample(&cpu_start);
+	start = gettimeusec();
+	if (phase_is_mmap(ph->type))
+		map_files(ph);
+	if (conf.runtime > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &ph->deadline);
+		ph->deadline.tv_sec += (time_t)conf.runtime;
+		ph->deadline.tv_nsec += (conf.runtime - (time_t)conf.runtime) * 1e9;
+		if (ph->deadline.tv_nsec >= 1000000000) {
+			ph->deadline.tv_sec++;
+			ph->deadline.tv_nsec -= 1000000000;
 		}
-		close(fd);
 	}
-	free(buf);
+	ph->start_nsec = gettimensec();
+	pthread_barrier_wait(&ph->start);
+
+	hist_init(&ph->hist);
+	for (i = 0; i < nr_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		hist_merge(&ph->hist, &workers[i].hist);
+		ph->ops += workers[i].ops;
+		ph->bytes += workers[i].bytes;
+		free(workers[i].buf);
+	}
+	if (phase_is_mmap(ph->type))
+		unmap_files(ph);
+	if (conf.fsync_end && phase_writes(ph->type))
+		sync_files();
+	ph->usec = gettimeusec() - start;
+
+	cpu_sample(&ph->cpu);
+	cpu_diff(&ph->cpu, &cpu_start);
+
+	if (phase_is_io(ph->type))
+		close_files();
+	if (phase_is_md(ph->type))
+		for (i = 0; i < conf.nr_threads; i++)
+			md_phase_done(&jobs[i].md, ph->type);
+	pthread_barrier_destroy(&ph->start);
+	free(workers);
 }
 
 int main(int argc, char **argv)
 {
-	long creat_time_sequential, write_time_sequential, read_time_sequential;
-	long write_time_random, read_time_random, delete_time_random, end_time_random;
+	struct phase *phases, *ph;
+	long long mismatches = 0;
+	int run, i;
 
-	if (argc != 3) {
-		usage(argv[0]);
-	}
-	dirname = argv[1];
-	req_size = atoi( argv[2] );
+	parse_args(argc, argv);
+	if (compare_mode)
+		return report_compare(argv[optind], argv[optind + 1],
+			COMPARE_ALPHA, COMPARE_THRESHOLD);
 
-	// Sequential Access Test
-	creat_time_sequential = gettimeusec();	
-	file_create();	
+	init_file_sizes();
+	init_jobs();
+	init_trace();
+	raise_file_limit();
+	cpu_init();
 
-	write_time_sequential = gettimeusec();	
-	file_write_sequential();
+	/* results of every run, kept for result file */
+	phases = calloc(conf.nr_runs * conf.nr_phases, sizeof(struct phase));
+	if (phases == NULL) {
+		err("calloc() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+
+	info("files %d, size %lld-%lld%s, request %d, threads %d, queue depth %d (%s)",
+		conf.nr_files, (long long)conf.size_min, (long long)conf.size_max,
+		conf.size_log ? " (log)" : "", conf.req_size, conf.nr_threads, conf.qdepth,
+		engine_name[conf.engine]);
+	if (conf.dist != DIST_UNIFORM)
+		info("random phases: %s", conf.dist_str);
+	if (conf.trace != NULL)
+		info("trace: %s, speedup %g", conf.trace, conf.replay_speed);
+	info("direct I/O: %s, fsync: %s%s%s", conf.direct_str, conf.fsync_str,
+		conf.fallocate ? ", preallocated" : "",
+		conf.drop_cache ? ", cold page cache" : "");
+	if (conf.verify)
+		info("verifying data, seed %u", conf.verify_seed);
 
-	read_time_sequential = gettimeusec();
-	file_read_sequential();
+	for (run = 0; run < conf.nr_runs; run++) {
+		if (conf.nr_runs > 1)
+			info("Run %d/%d ..", run + 1, conf.nr_runs);
 
-	// Random Access Test
-	srand(30);	
+		ph = &phases[run * conf.nr_phases];
+		for (i = 0; i < conf.nr_phases; i++) {
+			ph[i].type = conf.phases[i];
+			info("%s ..", phase_info[ph[i].type].title);
+			run_phase(&ph[i]);
+			mismatches += ph[i].mismatches;
+		}
 
-	write_time_random = gettimeusec();
-	file_write_random();
+		report_text(ph, conf.nr_phases);
+	}
 
-	read_time_random = gettimeusec();
-	file_read_random();
-	
-	delete_time_random = gettimeusec();
-	file_delete();
+	if (conf.output != NULL &&
+		report_write(phases, conf.nr_runs, conf.nr_phases) < 0)
+		return 1;
 
-	end_time_random = gettimeusec();
+	free(phases);
 
-	info("==============  File System Benchmark Execution Result (Time usec)  ==============");
-	info("File Create\t : \t%10ld", (write_time_sequential - creat_time_sequential));
-	info("Sequential Write : \t%10ld", (read_time_sequential - write_time_sequential));
-	info("Sequential Read\t : \t%10ld", (write_time_random - read_time_sequential));
-	info("Random Write\t : \t%10ld", (read_time_random - write_time_random));
-	info("Random Read\t : \t%10ld", (delete_time_random - read_time_random));
-	info("File Delete\t : \t%10ld", (end_time_random - delete_time_random));
-	info("Total\t\t : \t%10ld", (end_time_random - creat_time_sequential));
-	info("==================================================================================");
-}
\ No newline at end of file
+	if (mismatches > 0) {
+		err("verify: %lld blocks failed verification", mismatches);
+		return 1;
+	}
+	return 0;
+}
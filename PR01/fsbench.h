@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "cpu.h"
+#include "hist.h"
+
+#define err(fmt,args...) \
+	do { \
+		fprintf(stderr, "<%s:%d> " fmt "\n", __func__, __LINE__, ##args); \
+	} while (0)
+
+#define info(fmt,args...) \
+	do { \
+		fprintf(stdout, fmt "\n", ##args); \
+	} while (0)
+
+#define MAX_PHASES 32
+
+enum phase_type {
+	PHASE_CREATE,
+	PHASE_SEQ_WRITE,
+	PHASE_SEQ_READ,
+	PHASE_RAND_WRITE,
+	PHASE_RAND_READ,
+	PHASE_MIXED,
+	PHASE_REPLAY,
+	PHASE_MMAP_SEQ_WRITE, /* file I/O through shared mappings */
+	PHASE_MMAP_SEQ_READ,
+	PHASE_MMAP_RAND_WRITE,
+	PHASE_MMAP_RAND_READ,
+	PHASE_MKDIR, /* metadata phases, see md.h */
+	PHASE_MDCREATE,
+	PHASE_STAT,
+	PHASE_READDIR,
+	PHASE_RENAME,
+	PHASE_UNLINK,
+	PHASE_RMDIR,
+	PHASE_DELETE,
+	NR_PHASE_TYPES,
+};
+
+struct phase_desc {
+	const char *name; /* used with -p and in result files */
+	const char *title; /* used in result table */
+};
+extern const struct phase_desc phase_info[NR_PHASE_TYPES];
+
+/* how requests of an I/O phase are issued */
+enum io_engine {
+	ENGINE_SYNC, /* pread/pwrite, one thread per request in flight */
+	ENGINE_AIO, /* Linux native AIO, one thread per job */
+	NR_ENGINES,
+};
+extern const char *engine_name[NR_ENGINES];
+
+/* block popularity in random phases */
+enum access_dist {
+	DIST_UNIFORM, /* every block once per pass, in random order */
+	DIST_ZIPF, /* block of popularity rank k drawn with p ~ 1/k^theta */
+	DIST_HOTSPOT, /* hot_pct% of blocks get hot_access_pct% of requests */
+};
+
+/* benchmark configuration, from command line */
+struct config {
+	char *dirname;
+	int req_size;
+	int nr_files;
+	off_t size_min; /* file size distribution */
+	off_t size_max;
+	int size_log; /* 1: log-uniform between size_min and size_max */
+	int nr_threads;
+	int qdepth;
+	enum io_engine engine;
+	int read_pct; /* share of reads in mixed phase */
+	enum access_dist dist;
+	char *dist_str; /* as given with -d, for result files */
+	double zipf_theta;
+	double hot_pct;
+	double hot_access_pct;
+	int mmap_touch; /* bytes between touched bytes, 0: copy whole request */
+	int mmap_populate; /* MAP_POPULATE */
+	int mmap_advice; /* madvise() of mappings */
+	char *mmap_advice_str;
+	uint32_t direct_phases; /* bit per phase type opened with O_DIRECT */
+	char *direct_str; /* as given with -D, for result files */
+	int fsync_ops; /* fsync() after this many writes of a worker, 0: never */
+	int fsync_end; /* fsync() every file at the end of write phases */
+	char *fsync_str;
+	int fallocate; /* create phase preallocates files */
+	int drop_cache; /* evict files from page cache before I/O phases */
+	int md_width; /* directory tree of metadata phases */
+	int md_depth;
+	int md_files;
+	int verify; /* stamp written & check read blocks, see verify.h */
+	unsigned int verify_seed;
+	int perf_counters; /* 1: cycles, instructions, cache misses */
+	int server_pid; /* file system daemon to account CPU of, 0: none */
+	char *trace; /* requests of replay phase */
+	double replay_speed; /* 0: ignore trace timestamps */
+	double runtime; /* seconds per phase, 0: single pass */
+	long long bytes; /* bytes per phase, 0: single pass */
+	int nr_phases;
+	enum phase_type phases[MAX_PHASES];
+	int nr_runs; /* whole phase sequence is repeated */
+	char *output; /* result file */
+	int output_json; /* 1: JSON, 0: CSV */
+};
+extern struct config conf;
+
+/* one phase of one run */
+struct phase {
+	enum phase_type type;
+	int bounded; /* runtime or bytes limited, passes repeat */
+	struct timespec deadline;
+	uint32_t gen; /* stamped into blocks written by this phase */
+	uint64_t start_nsec; /* replay timestamps are relative to this */
+	long long bytes_issued;
+	volatile int stop;
+	pthread_barrier_t start;
+
+	long usec;
+	long long ops;
+	long long bytes;
+	struct cpu_usage cpu; /* used during the phase */
+	long long mismatches; /* blocks failing verification */
+	struct hist hist; /* request latency, nsec */
+};
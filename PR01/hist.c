@@ -0,0 +1,102 @@
+/*
+	Latency histogram for fsbench
+*/
+
+#include <string.h>
+
+#include "hist.h"
+
+static int
+hist_index(uint64_t value)
+{
+	int shift;
+
+	if (value < HIST_SUB_BUCKETS)
+		return value;
+
+	/* position of highest bit */
+	shift = 63 - __builtin_clzll(value);
+	if (shift > HIST_MAX_SHIFT)
+		return HIST_BUCKETS - 1;
+
+	/* bucket group of the power of two, then top bits below it */
+	return (shift - HIST_SUB_SHIFT + 1) * HIST_SUB_BUCKETS +
+		((value >> (shift - HIST_SUB_SHIFT)) & (HIST_SUB_BUCKETS - 1));
+}
+
+/* highest value falling into bucket 'index' */
+static uint64_t
+hist_value(int index)
+{
+	int group = index / HIST_SUB_BUCKETS;
+	int sub = index % HIST_SUB_BUCKETS;
+	int shift;
+
+	if (group == 0)
+		return sub;
+
+	shift = group + HIST_SUB_SHIFT - 1;
+	return ((uint64_t)(HIST_SUB_BUCKETS + sub + 1) << (shift - HIST_SUB_SHIFT)) - 1;
+}
+
+void
+hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void
+hist_add(struct hist *h, uint64_t value)
+{
+	h->buckets[hist_index(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+}
+
+void
+hist_merge(struct hist *dst, const struct hist *src)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t
+hist_percentile(const struct hist *h, double percentile)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	/* rank of the sample, 1 based */
+	rank = (uint64_t)(percentile / 100.0 * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank >= h->count)
+		return h->max;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	/* bucket bound may overshoot the real maximum */
+	if (hist_value(i) > h->max)
+		return h->max;
+	return hist_value(i);
+}
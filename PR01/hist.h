@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Latency histogram
+ * Log-linear buckets: values below HIST_SUB_BUCKETS are exact, every
+ * power of two above is split into HIST_SUB_BUCKETS buckets, which
+ * keeps the relative error below 1/HIST_SUB_BUCKETS (~1.6%).
+ * Values are nanoseconds, up to 2^HIST_MAX_SHIFT (~18 minutes).
+ */
+#define HIST_SUB_SHIFT 6
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_SHIFT)
+#define HIST_MAX_SHIFT 40
+#define HIST_BUCKETS ((HIST_MAX_SHIFT - HIST_SUB_SHIFT + 2) * HIST_SUB_BUCKETS)
+
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_init(struct hist *h);
+void hist_add(struct hist *h, uint64_t value);
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/* value below which 'percentile' (0-100) of the samples fall */
+uint64_t hist_percentile(const struct hist *h, double percentile);
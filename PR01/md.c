@@ -0,0 +1,171 @@
+/*
+	Metadata phases for fsbench
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "md.h"
+
+#define MAX_DIRS (1 << 24)
+
+void
+md_tree_init(struct md_tree *t, const char *root, int width, int depth,
+	int files)
+{
+	long long level = 1, d;
+	char path[PATH_MAX];
+	int i;
+
+	/* 1 + width + width^2 + ... + width^depth */
+	t->nr_dirs = 1;
+	for (i = 0; i < depth; i++) {
+		level *= width;
+		t->nr_dirs += level;
+		if (t->nr_dirs > MAX_DIRS) {
+			err("directory tree too large (more than %d directories)", MAX_DIRS);
+			exit(1);
+		}
+	}
+	t->files = files;
+	t->renamed = 0;
+
+	t->dirs = malloc(sizeof(char *) * t->nr_dirs);
+	if (t->dirs == NULL) {
+		err("malloc() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+
+	for (d = 0; d < t->nr_dirs; d++) {
+		if (d == 0)
+			snprintf(path, sizeof(path), "%s", root);
+		else
+			snprintf(path, sizeof(path), "%s/d%lld", t->dirs[(d - 1) / width],
+				(d - 1) % width);
+		t->dirs[d] = strdup(path);
+		if (t->dirs[d] == NULL) {
+			err("strdup() failed: [%s]", strerror(errno));
+			exit(1);
+		}
+	}
+}
+
+long long
+md_nr_requests(struct md_tree *t, enum phase_type type)
+{
+	switch (type) {
+	case PHASE_MKDIR:
+	case PHASE_READDIR:
+	case PHASE_RMDIR:
+		return t->nr_dirs;
+	default:
+		return t->nr_dirs * t->files;
+	}
+}
+
+static void
+file_path(struct md_tree *t, long long file, int renamed, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/%c%lld", t->dirs[file / t->files],
+		renamed ? 'r' : 'f', file % t->files);
+}
+
+static void
+md_readdir(const char *path)
+{
+	DIR *dir;
+
+	dir = opendir(path);
+	if (dir == NULL) {
+		err("opendir() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+
+	errno = 0;
+	while (readdir(dir) != NULL)
+		;
+	if (errno != 0) {
+		err("readdir() failed: [%s]", strerror(errno));
+		exit(1);
+	}
+	closedir(dir);
+}
+
+void
+md_do(struct md_tree *t, enum phase_type type, long long req)
+{
+	char path[PATH_MAX], new_path[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	switch (type) {
+	case PHASE_MKDIR:
+		if (mkdir(t->dirs[req], S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1) {
+			err("mkdir() failed: [%s]", strerror(errno));
+			exit(1);
+		}
+		break;
+	case PHASE_MDCREATE:
+		file_path(t, req, 0, path);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL,
+			S_IWUSR | S_IRUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd == -1) {
+			err("open() failed: [%s]", strerror(errno));
+			exit(1);
+		}
+		close(fd);
+		break;
+	case PHASE_STAT:
+		file_path(t, req, t->renamed, path);
+		if (stat(path, &st) == -1) {
+			err("stat() failed: [%s]", strerror(errno));
+			exit(1);
+		}
+		break;
+	case PHASE_READDIR:
+		md_readdir(t->dirs[req]);
+		break;
+	case PHASE_RENAME:
+		file_path(t, req, t->renamed, path);
+		file_path(t, req, !t->renamed, new_path);
+		if (rename(path, new_path) == -1) {
+			err("rename() failed: [%s]", strerror(errno));
+			exit(1);
+		}
+		break;
+	case PHASE_UNLINK:
+		file_path(t, req, t->renamed, path);
+		if (unlink(path) == -1) {
+			err("unlink() failed: [%s]", strerror(errno));
+			exit(1);
+		}
+		break;
+	case PHASE_RMDIR:
+		/* children first */
+		if (rmdir(t->dirs[t->nr_dirs - 1 - req]) == -1) {
+			err("rmdir() failed: [%s]", strerror(errno));
+			exit(1);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void
+md_phase_done(struct md_tree *t, enum phase_type type)
+{
+	if (type == PHASE_RENAME)
+		t->renamed = !t->renamed;
+	else if (type == PHASE_MDCREATE)
+		t->renamed = 0;
+}
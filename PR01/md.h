@@ -0,0 +1,35 @@
+#pragma once
+
+#include "fsbench.h"
+
+/* Directory tree of the metadata phases (mdtest style)
+ * A complete tree of 'width' subdirectories per directory, 'depth'
+ * levels below the root, with 'files' files in every directory.
+ * Directories are numbered breadth first, so the parent of directory
+ * d is (d - 1) / width and parents come before their children. File
+ * i lives in directory i / files.
+ */
+struct md_tree {
+	char **dirs; /* paths, dirs[0] is the root */
+	long long nr_dirs;
+	int files; /* per directory */
+	int renamed; /* files carry the name given by the rename phase */
+};
+
+static inline int
+phase_is_md(enum phase_type type)
+{
+	return type >= PHASE_MKDIR && type <= PHASE_RMDIR;
+}
+
+void md_tree_init(struct md_tree *t, const char *root, int width, int depth,
+	int files);
+
+/* requests of a metadata phase: directories or files */
+long long md_nr_requests(struct md_tree *t, enum phase_type type);
+
+/* request 'req' of metadata phase 'type', exits on failure */
+void md_do(struct md_tree *t, enum phase_type type, long long req);
+
+/* called once all requests of a phase completed */
+void md_phase_done(struct md_tree *t, enum phase_type type);
@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Function: usage
+# Purpose: To print how the sweep is invoked & exit
+usage() {
+	echo "Usage: $0 <working directory> <request size> [fsbench options]" >&2
+	echo "  Runs the sequential & random phases with the aio engine at" >&2
+	echo "  queue depth 1, 2, 4 .. 128 (QD_LIST overrides) and prints" >&2
+	echo "  MB/s and p99 latency (usec) of each phase per queue depth." >&2
+	exit 1
+}
+
+if [ $# -lt 2 ]; then
+	usage
+fi
+
+DIR="$1"
+REQ_SIZE="$2"
+shift 2
+
+FSBENCH="$(dirname "$0")/fsbench"
+QD_LIST=${QD_LIST:-"1 2 4 8 16 32 64 128"}
+PHASES="create,seqwrite,seqread,randwrite,randread,delete"
+RESULT=$(mktemp)
+trap 'rm -f "$RESULT"' EXIT
+
+printf "%-5s %12s %12s %12s %12s %10s %10s %10s %10s\n" "QD" \
+	"seqwrite" "seqread" "randwrite" "randread" \
+	"p99 sw" "p99 sr" "p99 rw" "p99 rr"
+
+for QD in $QD_LIST
+do
+	# extra options come last, so they win over ours
+	if ! "$FSBENCH" -e aio -q $QD -p $PHASES -o "$RESULT" "$@" \
+		"$DIR" "$REQ_SIZE" > /dev/null; then
+		echo "fsbench failed at queue depth $QD" >&2
+		exit 1
+	fi
+
+	# average MB/s (column 8) & p99 (column 12) over runs
+	awk -F, -v qd=$QD '
+		/^[0-9]/ { mbps[$3] += $8; p99[$3] += $12; n[$3]++ }
+		END {
+			printf "%-5d", qd
+			split("seqwrite seqread randwrite randread", ph, " ")
+			for (i = 1; i <= 4; i++)
+				printf " %12.2f", n[ph[i]] ? mbps[ph[i]] / n[ph[i]] : 0
+			for (i = 1; i <= 4; i++)
+				printf " %10.1f", n[ph[i]] ? p99[ph[i]] / n[ph[i]] : 0
+			printf "\n"
+		}' "$RESULT"
+done
+
+exit 0
@@ -0,0 +1,671 @@
+/*
+	Result output & comparison for fsbench
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <sys/vfs.h>
+
+#include "fsbench.h"
+#include "report.h"
+
+#define MAX_LINE 1024
+
+static const double percentiles[] = { 50, 90, 99, 99.9 };
+#define NR_PERCENTILES (sizeof(percentiles) / sizeof(percentiles[0]))
+
+/* derived numbers of a phase */
+static double
+phase_iops(const struct phase *ph)
+{
+	return ph->usec ? ph->ops * 1e6 / ph->usec : 0;
+}
+
+static double
+phase_mbps(const struct phase *ph)
+{
+	return ph->usec ? (double)ph->bytes / ph->usec : 0;
+}
+
+static double
+phase_lat_usec(const struct phase *ph, double percentile)
+{
+	return hist_percentile(&ph->hist, percentile) / 1000.0;
+}
+
+static double
+phase_lat_mean_usec(const struct phase *ph)
+{
+	return ph->hist.count ? (double)ph->hist.sum / ph->hist.count / 1000.0 : 0;
+}
+
+/* 'value' per 'count', -1 if either is unavailable */
+static double
+ratio(double value, double count)
+{
+	return value < 0 || count <= 0 ? -1 : value / count;
+}
+
+/* table cell of width 10, "-" for unavailable values */
+static const char *
+cell(char *buf, double value, int prec)
+{
+	if (value < 0)
+		snprintf(buf, 16, "%10s", "-");
+	else
+		snprintf(buf, 16, "%10.*f", prec, value);
+	return buf;
+}
+
+static void
+report_cpu(struct phase *phases, int nr_phases)
+{
+	char c[6][16];
+	struct cpu_usage *u;
+	double cpu, mb;
+	int i;
+
+	info("==============  CPU & Syscalls (fsbench)  =========================================");
+	info("%-17s: \t%10s \t%10s \t%10s \t%10s \t%10s \t%10s", "", "user ms", "sys ms",
+		"cpu us/op", "cpu us/MB", "ctxsw/op", "rw sys/op");
+	for (i = 0; i < nr_phases; i++) {
+		u = &phases[i].cpu;
+		cpu = u->utime + u->stime;
+		mb = phases[i].bytes / 1e6;
+		info("%-17s: \t%s \t%s \t%s \t%s \t%s \t%s", phase_info[phases[i].type].title,
+			cell(c[0], u->utime / 1000.0, 1), cell(c[1], u->stime / 1000.0, 1),
+			cell(c[2], ratio(cpu, phases[i].ops), 2), cell(c[3], ratio(cpu, mb), 1),
+			cell(c[4], ratio(u->nvcsw + u->nivcsw, phases[i].ops), 2),
+			cell(c[5], ratio(u->syscalls, phases[i].ops), 2));
+	}
+
+	if (conf.server_pid > 0) {
+		info("==============  CPU & Syscalls (pid %d)  ==========================================",
+			conf.server_pid);
+		info("%-17s: \t%10s \t%10s \t%10s \t%10s \t%10s", "", "user ms", "sys ms",
+			"cpu us/op", "cpu us/MB", "rw sys/op");
+		for (i = 0; i < nr_phases; i++) {
+			u = &phases[i].cpu;
+			cpu = u->srv_utime < 0 ? -1 : u->srv_utime + u->srv_stime;
+			mb = phases[i].bytes / 1e6;
+			info("%-17s: \t%s \t%s \t%s \t%s \t%s", phase_info[phases[i].type].title,
+				cell(c[0], ratio(u->srv_utime, 1000), 1),
+				cell(c[1], ratio(u->srv_stime, 1000), 1),
+				cell(c[2], ratio(cpu, phases[i].ops), 2), cell(c[3], ratio(cpu, mb), 1),
+				cell(c[4], ratio(u->srv_syscalls, phases[i].ops), 2));
+		}
+	}
+
+	if (conf.perf_counters) {
+		info("==============  Hardware Counters (fsbench)  ======================================");
+		info("%-17s: \t%10s \t%10s \t%10s \t%10s", "", "cycles/op", "cycles/B",
+			"IPC", "misses/op");
+		for (i = 0; i < nr_phases; i++) {
+			u = &phases[i].cpu;
+			info("%-17s: \t%s \t%s \t%s \t%s", phase_info[phases[i].type].title,
+				cell(c[0], ratio(u->cycles, phases[i].ops), 0),
+				cell(c[1], ratio(u->cycles, phases[i].bytes), 2),
+				cell(c[2], u->instructions < 0 ? -1 : ratio(u->instructions, u->cycles), 2),
+				cell(c[3], ratio(u->cache_misses, phases[i].ops), 2));
+		}
+	}
+}
+
+void
+report_text(struct phase *phases, int nr_phases)
+{
+	struct phase *ph;
+	long total = 0;
+	unsigned int j;
+	char line[256];
+	int i, len;
+
+	info("==============  File System Benchmark Execution Result (Time usec)  ==============");
+	info("%-17s: \t%10s \t%10s \t%10s \t%10s", "", "usec", "ops", "IOPS", "MB/s");
+	for (i = 0; i < nr_phases; i++) {
+		ph = &phases[i];
+		info("%-17s: \t%10ld \t%10lld \t%10.0f \t%10.2f",
+			phase_info[ph->type].title, ph->usec, ph->ops,
+			phase_iops(ph), phase_mbps(ph));
+		total += ph->usec;
+	}
+	info("%-17s: \t%10ld", "Total", total);
+
+	info("==============  Request Latency (usec)  ===========================================");
+	info("%-17s: \t%8s \t%8s \t%8s \t%8s \t%8s", "", "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < nr_phases; i++) {
+		ph = &phases[i];
+		len = snprintf(line, sizeof(line), "%-17s: ", phase_info[ph->type].title);
+		for (j = 0; j < NR_PERCENTILES; j++)
+			len += snprintf(line + len, sizeof(line) - len, "\t%8.1f ",
+				phase_lat_usec(ph, percentiles[j]));
+		snprintf(line + len, sizeof(line) - len, "\t%8.1f", ph->hist.max / 1000.0);
+		info("%s", line);
+	}
+
+	info("==============  Page Faults  ======================================================");
+	info("%-17s: \t%10s \t%10s \t%10s \t%10s", "", "minor", "major", "faults/s",
+		"faults/op");
+	for (i = 0; i < nr_phases; i++) {
+		ph = &phases[i];
+		info("%-17s: \t%10ld \t%10ld \t%10.0f \t%10.2f",
+			phase_info[ph->type].title, ph->cpu.minflt, ph->cpu.majflt,
+			ph->usec ? (ph->cpu.minflt + ph->cpu.majflt) * 1e6 / ph->usec : 0,
+			ph->ops ? (double)(ph->cpu.minflt + ph->cpu.majflt) / ph->ops : 0);
+	}
+
+	report_cpu(phases, nr_phases);
+
+	if (conf.verify) {
+		info("==============  Verification (seed %u)  ==========================================",
+			conf.verify_seed);
+		for (i = 0; i < nr_phases; i++)
+			info("%-17s: \t%10lld mismatches", phase_info[phases[i].type].title,
+				phases[i].mismatches);
+	}
+	info("==================================================================================");
+}
+
+/* machine & filesystem the benchmark ran on */
+struct environment {
+	char hostname[256];
+	struct utsname uts;
+	long nr_cpus;
+	unsigned long fs_type; /* statfs() f_type of working directory */
+	char date[64];
+};
+
+static void
+get_environment(struct environment *env)
+{
+	struct statfs stfs;
+	time_t now = time(NULL);
+
+	memset(env, 0, sizeof(*env));
+	gethostname(env->hostname, sizeof(env->hostname) - 1);
+	uname(&env->uts);
+	env->nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (statfs(conf.dirname, &stfs) == 0)
+		env->fs_type = stfs.f_type;
+	strftime(env->date, sizeof(env->date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+}
+
+/* phase list as "create,seqwrite,..." */
+static void
+phase_list(char *buf, size_t size)
+{
+	int i, len = 0;
+
+	buf[0] = '\0';
+	for (i = 0; i < conf.nr_phases && len < (int)size; i++)
+		len += snprintf(buf + len, size - len, "%s%s", i ? "," : "",
+			phase_info[conf.phases[i]].name);
+}
+
+/* JSON string, only quotes & backslashes need escaping in paths */
+static void
+json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', fp);
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static void
+write_json(FILE *fp, struct environment *env, struct phase *phases,
+	int nr_runs, int nr_phases)
+{
+	struct phase *ph;
+	char list[MAX_LINE];
+	unsigned int j;
+	int run, i;
+
+	phase_list(list, sizeof(list));
+
+	fprintf(fp, "{\n  \"config\": {\n    \"dirname\": ");
+	json_string(fp, conf.dirname);
+	fprintf(fp, ",\n    \"req_size\": %d,\n    \"nr_files\": %d,\n"
+		"    \"size_min\": %lld,\n    \"size_max\": %lld,\n    \"size_log\": %d,\n"
+		"    \"nr_threads\": %d,\n    \"qdepth\": %d,\n    \"engine\": \"%s\",\n"
+		"    \"read_pct\": %d,\n    \"dist\": \"%s\",\n"
+		"    \"runtime\": %g,\n    \"bytes\": %lld,\n    \"nr_runs\": %d,\n"
+		"    \"mmap_touch\": %d,\n    \"mmap_populate\": %d,\n"
+		"    \"mmap_advice\": \"%s\",\n    \"direct\": \"%s\",\n"
+		"    \"fsync\": \"%s\",\n    \"fallocate\": %d,\n    \"drop_cache\": %d,\n"
+		"    \"md_tree\": \"%dx%dx%d\",\n    \"phases\": \"%s\"\n  },\n",
+		conf.req_size, conf.nr_files, (long long)conf.size_min,
+		(long long)conf.size_max, conf.size_log, conf.nr_threads, conf.qdepth,
+		engine_name[conf.engine], conf.read_pct, conf.dist_str, conf.runtime,
+		conf.bytes, nr_runs, conf.mmap_touch, conf.mmap_populate,
+		conf.mmap_advice_str, conf.direct_str, conf.fsync_str, conf.fallocate,
+		conf.drop_cache, conf.md_width, conf.md_depth, conf.md_files, list);
+
+	if (conf.verify)
+		fprintf(fp, "  \"verify_seed\": %u,\n", conf.verify_seed);
+	if (conf.trace != NULL) {
+		fprintf(fp, "  \"trace\": ");
+		json_string(fp, conf.trace);
+		fprintf(fp, ",\n  \"replay_speed\": %g,\n", conf.replay_speed);
+	}
+
+	fprintf(fp, "  \"environment\": {\n    \"hostname\": ");
+	json_string(fp, env->hostname);
+	fprintf(fp, ",\n    \"kernel\": ");
+	json_string(fp, env->uts.release);
+	fprintf(fp, ",\n    \"machine\": ");
+	json_string(fp, env->uts.machine);
+	fprintf(fp, ",\n    \"nr_cpus\": %ld,\n    \"fs_type\": \"0x%lx\",\n"
+		"    \"date\": \"%s\"\n  },\n",
+		env->nr_cpus, env->fs_type, env->date);
+
+	fprintf(fp, "  \"runs\": [\n");
+	for (run = 0; run < nr_runs; run++) {
+		fprintf(fp, "    { \"run\": %d, \"phases\": [\n", run);
+		for (i = 0; i < nr_phases; i++) {
+			ph = &phases[run * nr_phases + i];
+			fprintf(fp, "      { \"index\": %d, \"phase\": \"%s\", \"usec\": %ld, "
+				"\"ops\": %lld, \"bytes\": %lld, \"iops\": %.1f, \"mbps\": %.3f, "
+				"\"lat_usec\": { \"mean\": %.1f",
+				i, phase_info[ph->type].name, ph->usec, ph->ops, ph->bytes,
+				phase_iops(ph), phase_mbps(ph), phase_lat_mean_usec(ph));
+			for (j = 0; j < NR_PERCENTILES; j++)
+				fprintf(fp, ", \"p%g\": %.1f", percentiles[j],
+					phase_lat_usec(ph, percentiles[j]));
+			fprintf(fp, ", \"max\": %.1f }, \"minflt\": %ld, \"majflt\": %ld, ",
+				ph->hist.max / 1000.0, ph->cpu.minflt, ph->cpu.majflt);
+			fprintf(fp, "\"cpu\": { \"utime_us\": %ld, \"stime_us\": %ld, "
+				"\"nvcsw\": %ld, \"nivcsw\": %ld, \"syscalls\": %lld, "
+				"\"srv_utime_us\": %ld, \"srv_stime_us\": %ld, \"srv_syscalls\": %lld, "
+				"\"cycles\": %lld, \"instructions\": %lld, \"cache_misses\": %lld }, "
+				"\"mismatches\": %lld }%s\n",
+				ph->cpu.utime, ph->cpu.stime, ph->cpu.nvcsw, ph->cpu.nivcsw,
+				ph->cpu.syscalls, ph->cpu.srv_utime, ph->cpu.srv_stime,
+				ph->cpu.srv_syscalls, ph->cpu.cycles, ph->cpu.instructions,
+				ph->cpu.cache_misses, ph->mismatches, i + 1 < nr_phases ? "," : "");
+		}
+		fprintf(fp, "    ] }%s\n", run + 1 < nr_runs ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+}
+
+/* config & environment go to comment lines, see report_compare() */
+static void
+write_csv(FILE *fp, struct environment *env, struct phase *phases,
+	int nr_runs, int nr_phases)
+{
+	struct phase *ph;
+	char list[MAX_LINE];
+	unsigned int j;
+	int run, i;
+
+	phase_list(list, sizeof(list));
+
+	fprintf(fp, "# config: req_size=%d nr_files=%d size=%lld-%lld%s "
+		"threads=%d qdepth=%d engine=%s read_pct=%d dist=%s runtime=%g "
+		"bytes=%lld mmap=touch:%d%s:%s direct=%s fsync=%s fallocate=%d "
+		"drop_cache=%d md_tree=%dx%dx%d phases=%s\n",
+		conf.req_size, conf.nr_files, (long long)conf.size_min,
+		(long long)conf.size_max, conf.size_log ? ":log" : "", conf.nr_threads,
+		conf.qdepth, engine_name[conf.engine], conf.read_pct, conf.dist_str,
+		conf.runtime, conf.bytes, conf.mmap_touch,
+		conf.mmap_populate ? ":populate" : "", conf.mmap_advice_str,
+		conf.direct_str, conf.fsync_str, conf.fallocate, conf.drop_cache,
+		conf.md_width, conf.md_depth, conf.md_files, list);
+	if (conf.trace != NULL)
+		fprintf(fp, "# trace: %s speedup=%g\n", conf.trace, conf.replay_speed);
+	if (conf.verify)
+		fprintf(fp, "# verify: seed=%u\n", conf.verify_seed);
+	fprintf(fp, "# environment: dirname=%s hostname=%s kernel=%s machine=%s "
+		"nr_cpus=%ld fs_type=0x%lx date=%s\n",
+		conf.dirname, env->hostname, env->uts.release, env->uts.machine,
+		env->nr_cpus, env->fs_type, env->date);
+
+	fprintf(fp, "run,index,phase,usec,ops,bytes,iops,mbps,lat_mean_us");
+	for (j = 0; j < NR_PERCENTILES; j++)
+		fprintf(fp, ",lat_p%g_us", percentiles[j]);
+	fprintf(fp, ",lat_max_us,minflt,majflt,utime_us,stime_us,nvcsw,nivcsw,syscalls,"
+		"srv_utime_us,srv_stime_us,srv_syscalls,cycles,instructions,cache_misses,"
+		"mismatches\n");
+
+	for (run = 0; run < nr_runs; run++) {
+		for (i = 0; i < nr_phases; i++) {
+			ph = &phases[run * nr_phases + i];
+			fprintf(fp, "%d,%d,%s,%ld,%lld,%lld,%.1f,%.3f,%.1f", run, i,
+				phase_info[ph->type].name, ph->usec, ph->ops, ph->bytes,
+				phase_iops(ph), phase_mbps(ph), phase_lat_mean_usec(ph));
+			for (j = 0; j < NR_PERCENTILES; j++)
+				fprintf(fp, ",%.1f", phase_lat_usec(ph, percentiles[j]));
+			fprintf(fp, ",%.1f,%ld,%ld", ph->hist.max / 1000.0, ph->cpu.minflt,
+				ph->cpu.majflt);
+			fprintf(fp, ",%ld,%ld,%ld,%ld,%lld,%ld,%ld,%lld,%lld,%lld,%lld,%lld\n",
+				ph->cpu.utime, ph->cpu.stime, ph->cpu.nvcsw, ph->cpu.nivcsw,
+				ph->cpu.syscalls, ph->cpu.srv_utime, ph->cpu.srv_stime,
+				ph->cpu.srv_syscalls, ph->cpu.cycles, ph->cpu.instructions,
+				ph->cpu.cache_misses, ph->mismatches);
+		}
+	}
+}
+
+int
+report_write(struct phase *phases, int nr_runs, int nr_phases)
+{
+	struct environment env;
+	FILE *fp;
+
+	fp = fopen(conf.output, "w");
+	if (fp == NULL) {
+		err("fopen() failed: [%s]", strerror(errno));
+		return -1;
+	}
+
+	get_environment(&env);
+	if (conf.output_json)
+		write_json(fp, &env, phases, nr_runs, nr_phases);
+	else
+		write_csv(fp, &env, phases, nr_runs, nr_phases);
+
+	if (fclose(fp) != 0) {
+		err("fclose() failed: [%s]", strerror(errno));
+		return -1;
+	}
+	info("Results saved to %s", conf.output);
+	return 0;
+}
+
+/* one CSV row, i.e. one phase of one run */
+struct sample {
+	int index;
+	char phase[32];
+	long long bytes;
+	double iops;
+	double mbps;
+	double p99;
+};
+
+struct result_file {
+	char config[MAX_LINE];
+	struct sample *samples;
+	int nr_samples;
+};
+
+static int
+read_csv(const char *path, struct result_file *res)
+{
+	char line[MAX_LINE];
+	struct sample s, *samples;
+	double unused[3];
+	int run, capacity = 0;
+	long usec;
+	long long ops;
+	FILE *fp;
+
+	memset(res, 0, sizeof(*res));
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		err("%s: fopen() failed: [%s]", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "# config:", 9) == 0) {
+			snprintf(res->config, sizeof(res->config), "%s", line + 9);
+			continue;
+		}
+
+		/* run,index,phase,usec,ops,bytes,iops,mbps,mean,p50,p90,p99,... */
+		if (sscanf(line, "%d,%d,%31[^,],%ld,%lld,%lld,%lf,%lf,%lf,%lf,%lf,%lf",
+				&run, &s.index, s.phase, &usec, &ops, &s.bytes, &s.iops,
+				&s.mbps, &unused[0], &unused[1], &unused[2], &s.p99) != 12)
+			continue; /* comment or header */
+
+		if (res->nr_samples == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			samples = realloc(res->samples, capacity * sizeof(struct sample));
+			if (samples == NULL) {
+				err("realloc() failed: [%s]", strerror(errno));
+				fclose(fp);
+				return -1;
+			}
+			res->samples = samples;
+		}
+		res->samples[res->nr_samples++] = s;
+	}
+	fclose(fp);
+
+	if (res->nr_samples == 0) {
+		err("%s: no results found", path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Regularized incomplete beta function I_x(a, b)
+ * evaluated by continued fraction (modified Lentz's method)
+ * Ref: Numerical Recipes in C, 6.4
+ */
+static double
+betacf(double a, double b, double x)
+{
+	const double eps = 1e-12, fpmin = 1e-300;
+	double aa, c, d, del, h;
+	int m, m2;
+
+	c = 1.0;
+	d = 1.0 - (a + b) * x / (a + 1.0);
+	if (fabs(d) < fpmin)
+		d = fpmin;
+	d = 1.0 / d;
+	h = d;
+	for (m = 1; m <= 300; m++) {
+		m2 = 2 * m;
+		aa = m * (b - m) * x / ((a - 1.0 + m2) * (a + m2));
+		d = 1.0 + aa * d;
+		if (fabs(d) < fpmin)
+			d = fpmin;
+		c = 1.0 + aa / c;
+		if (fabs(c) < fpmin)
+			c = fpmin;
+		d = 1.0 / d;
+		h *= d * c;
+		aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + 1.0 + m2));
+		d = 1.0 + aa * d;
+		if (fabs(d) < fpmin)
+			d = fpmin;
+		c = 1.0 + aa / c;
+		if (fabs(c) < fpmin)
+			c = fpmin;
+		d = 1.0 / d;
+		del = d * c;
+		h *= del;
+		if (fabs(del - 1.0) < eps)
+			break;
+	}
+	return h;
+}
+
+static double
+ibeta(double a, double b, double x)
+{
+	double bt;
+
+	if (x <= 0.0)
+		return 0.0;
+	if (x >= 1.0)
+		return 1.0;
+
+	bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+		a * log(x) + b * log(1.0 - x));
+	if (x < (a + 1.0) / (a + b + 2.0))
+		return bt * betacf(a, b, x) / a;
+	return 1.0 - bt * betacf(b, a, 1.0 - x) / b;
+}
+
+struct moments {
+	int n;
+	double mean;
+	double var; /* sample variance */
+};
+
+/* two sided p-value of Welch's t-test, -1 if not enough runs */
+static double
+welch_pvalue(struct moments *x, struct moments *y)
+{
+	double vx, vy, se2, t, df;
+
+	if (x->n < 2 || y->n < 2)
+		return -1;
+
+	vx = x->var / x->n;
+	vy = y->var / y->n;
+	se2 = vx + vy;
+	if (se2 == 0)
+		return x->mean == y->mean ? 1.0 : 0.0;
+
+	t = (y->mean - x->mean) / sqrt(se2);
+	df = se2 * se2 / (vx * vx / (x->n - 1) + vy * vy / (y->n - 1));
+
+	/* P(|T| > |t|) of Student's t with df degrees of freedom */
+	return ibeta(df / 2.0, 0.5, df / (df + t * t));
+}
+
+enum metric {
+	METRIC_IOPS,
+	METRIC_MBPS,
+	METRIC_P99,
+};
+
+static double
+sample_value(const struct sample *s, enum metric metric)
+{
+	switch (metric) {
+	case METRIC_IOPS:
+		return s->iops;
+	case METRIC_MBPS:
+		return s->mbps;
+	default:
+		return s->p99;
+	}
+}
+
+/* mean & variance of 'metric' over all runs of phase 'index' */
+static void
+get_moments(struct result_file *res, int index, enum metric metric,
+	struct moments *m)
+{
+	double sum = 0, sq = 0, v;
+	int i;
+
+	m->n = 0;
+	for (i = 0; i < res->nr_samples; i++) {
+		if (res->samples[i].index != index)
+			continue;
+		v = sample_value(&res->samples[i], metric);
+		sum += v;
+		sq += v * v;
+		m->n++;
+	}
+
+	m->mean = m->n ? sum / m->n : 0;
+	m->var = m->n > 1 ? (sq - sum * sum / m->n) / (m->n - 1) : 0;
+	if (m->var < 0) /* rounding */
+		m->var = 0;
+}
+
+/* returns 1 if candidate regressed on 'metric' of phase 'index' */
+static int
+compare_metric(struct result_file *base, struct result_file *cand,
+	const struct sample *s, enum metric metric, double alpha, double threshold)
+{
+	static const char *metric_name[] = { "IOPS", "MB/s", "p99 usec" };
+	struct moments x, y;
+	double change, p;
+	int lower_is_better = metric == METRIC_P99;
+	int worse, regression = 0;
+	const char *verdict;
+	char pstr[16];
+
+	get_moments(base, s->index, metric, &x);
+	get_moments(cand, s->index, metric, &y);
+	if (x.n == 0 || y.n == 0)
+		return 0;
+
+	change = x.mean != 0 ? (y.mean - x.mean) / x.mean * 100.0 : 0;
+	worse = lower_is_better ? change > threshold : change < -threshold;
+	p = welch_pvalue(&x, &y);
+
+	if (p < 0) {
+		verdict = worse ? "worse? (need >= 2 runs)" : "";
+		snprintf(pstr, sizeof(pstr), "%8s", "-");
+	} else {
+		snprintf(pstr, sizeof(pstr), "%8.4f", p);
+		if (p >= alpha || fabs(change) <= threshold)
+			verdict = "";
+		else if (worse)
+			verdict = "REGRESSION";
+		else
+			verdict = "improved";
+		regression = p < alpha && worse;
+	}
+
+	info("%2d %-10s %-9s %12.2f +- %-10.2f %12.2f +- %-10.2f %+8.1f%% %s  %s",
+		s->index, s->phase, metric_name[metric], x.mean, sqrt(x.var),
+		y.mean, sqrt(y.var), change, pstr, verdict);
+	return regression;
+}
+
+int
+report_compare(const char *baseline, const char *candidate, double alpha,
+	double threshold)
+{
+	struct result_file base, cand;
+	const struct sample *s;
+	int i, regressions = 0, last_index = -1;
+
+	if (read_csv(baseline, &base) < 0 || read_csv(candidate, &cand) < 0)
+		return 2;
+
+	if (strcmp(base.config, cand.config) != 0)
+		info("WARNING: configurations differ\n  baseline: %s  candidate: %s",
+			base.config, cand.config);
+
+	info("==============  Comparison (baseline vs candidate)  ===============================");
+	info("%2s %-10s %-9s %27s %27s %9s %8s", "#", "phase", "metric",
+		"baseline mean +- sd", "candidate mean +- sd", "change", "p");
+
+	/* every phase index once, in order of first appearance */
+	for (i = 0; i < base.nr_samples; i++) {
+		s = &base.samples[i];
+		if (s->index <= last_index)
+			continue;
+		last_index = s->index;
+
+		/* throughput, file & metadata phases move no bytes */
+		if (s->bytes == 0)
+			regressions += compare_metric(&base, &cand, s, METRIC_IOPS,
+				alpha, threshold);
+		else
+			regressions += compare_metric(&base, &cand, s, METRIC_MBPS,
+				alpha, threshold);
+		regressions += compare_metric(&base, &cand, s, METRIC_P99,
+			alpha, threshold);
+	}
+	info("==================================================================================");
+	info("%d significant regression(s)", regressions);
+
+	free(base.samples);
+	free(cand.samples);
+	return regressions > 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "fsbench.h"
+
+/* result table of one run on stdout */
+void report_text(struct phase *phases, int nr_phases);
+
+/* config, environment & results of all runs to conf.output
+ * phases of run r are phases[r * nr_phases ...]
+ */
+int report_write(struct phase *phases, int nr_runs, int nr_phases);
+
+/* compares two CSV result files, returns 1 on significant regression */
+int report_compare(const char *baseline, const char *candidate, double alpha,
+	double threshold);
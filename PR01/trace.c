@@ -0,0 +1,90 @@
+/*
+	I/O trace loading for fsbench replay phase
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "fsbench.h"
+#include "trace.h"
+
+static int
+parse_op(const char *op)
+{
+	if (strcasecmp(op, "r") == 0 || strcasecmp(op, "read") == 0)
+		return 0;
+	if (strcasecmp(op, "w") == 0 || strcasecmp(op, "write") == 0)
+		return 1;
+	return -1;
+}
+
+long long
+trace_load(const char *path, struct trace_rec **recs)
+{
+	struct trace_rec *rec = NULL, *tmp;
+	long long nr = 0, capacity = 0, offset, lineno = 0;
+	double timestamp, first = 0;
+	size_t size;
+	char line[256], op[16];
+	int file, write_op;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		err("%s: fopen() failed: [%s]", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		if (sscanf(line, "%15s %d %lld %zu %lf", op, &file, &offset, &size,
+				&timestamp) != 5 || (write_op = parse_op(op)) < 0 ||
+			file < 0 || offset < 0 || size == 0 || timestamp < 0) {
+			err("%s:%lld: malformed request", path, lineno);
+			goto error;
+		}
+
+		if (nr == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			tmp = realloc(rec, capacity * sizeof(struct trace_rec));
+			if (tmp == NULL) {
+				err("realloc() failed: [%s]", strerror(errno));
+				goto error;
+			}
+			rec = tmp;
+		}
+
+		if (nr == 0)
+			first = timestamp;
+		if (timestamp < first)
+			timestamp = first; /* out of order, issue right away */
+
+		rec[nr].write = write_op;
+		rec[nr].file = file;
+		rec[nr].offset = offset;
+		rec[nr].size = size;
+		rec[nr].time = (timestamp - first) * 1e9;
+		nr++;
+	}
+	fclose(fp);
+
+	if (nr == 0) {
+		err("%s: empty trace", path);
+		free(rec);
+		return -1;
+	}
+
+	*recs = rec;
+	return nr;
+
+error:
+	fclose(fp);
+	free(rec);
+	return -1;
+}
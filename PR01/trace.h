@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* one request of a recorded I/O trace
+ * Trace files are text, one request per line:
+ *
+ *   <op> <file> <offset> <size> <timestamp>
+ *
+ * op is R/read or W/write, file the fsbench file number (file-<n>),
+ * offset & size in bytes, timestamp in seconds. Timestamps are made
+ * relative to the first request. Lines starting with '#' are skipped.
+ */
+struct trace_rec {
+	int write;
+	int file;
+	off_t offset;
+	size_t size;
+	uint64_t time; /* nsec since first request */
+};
+
+/* reads trace at 'path' into a malloc()ed array, returns number of
+ * requests or -1 on error
+ */
+long long trace_load(const char *path, struct trace_rec **recs);
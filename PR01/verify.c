@@ -0,0 +1,115 @@
+/*
+	Block stamping & verification for fsbench
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fsbench.h"
+#include "verify.h"
+
+#define VERIFY_MAGIC 0xfb5eed01
+
+struct verify_hdr {
+	uint32_t magic;
+	uint32_t gen;
+	uint32_t file;
+	uint32_t seed;
+	uint64_t offset;
+	uint64_t checksum; /* of the header (checksum = 0) & payload */
+};
+
+static uint64_t
+splitmix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* 64-bit multiply-xorshift over words, a few cycles per word */
+static uint64_t
+checksum(const struct verify_hdr *hdr, const char *buf, size_t size)
+{
+	struct verify_hdr h = *hdr;
+	uint64_t sum = 0x6a09e667f3bcc909ULL, word;
+	size_t i;
+
+	h.checksum = 0;
+	for (i = 0; i < sizeof(h); i += sizeof(word)) {
+		memcpy(&word, (char *)&h + i, sizeof(word));
+		sum = (sum ^ word) * 0x100000001b3ULL;
+		sum ^= sum >> 29;
+	}
+	for (i = sizeof(h); i + sizeof(word) <= size; i += sizeof(word)) {
+		memcpy(&word, buf + i, sizeof(word));
+		sum = (sum ^ word) * 0x100000001b3ULL;
+		sum ^= sum >> 29;
+	}
+	for (; i < size; i++)
+		sum = (sum ^ (unsigned char)buf[i]) * 0x100000001b3ULL;
+
+	return sum;
+}
+
+void
+verify_fill(char *buf, size_t size, int file, off_t offset, uint32_t gen)
+{
+	struct verify_hdr hdr = {
+		.magic = VERIFY_MAGIC,
+		.gen = gen,
+		.file = file,
+		.seed = conf.verify_seed,
+		.offset = offset,
+	};
+	uint64_t state, word;
+	size_t i;
+
+	/* xorshift64 stream, seeded from the header */
+	state = splitmix64(((uint64_t)conf.verify_seed << 32 | gen) ^
+		splitmix64((uint64_t)file << 48 ^ offset));
+	for (i = sizeof(hdr); i + sizeof(word) <= size; i += sizeof(word)) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		word = state;
+		memcpy(buf + i, &word, sizeof(word));
+	}
+	for (; i < size; i++)
+		buf[i] = (char)i;
+
+	hdr.checksum = checksum(&hdr, buf, size);
+	memcpy(buf, &hdr, sizeof(hdr));
+}
+
+int
+verify_check(const char *buf, size_t size, int file, off_t offset,
+	uint32_t min_gen, char *why, size_t len)
+{
+	struct verify_hdr hdr;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+
+	if (hdr.magic != VERIFY_MAGIC) {
+		snprintf(why, len, "no block header (magic 0x%08x)", hdr.magic);
+		return -1;
+	}
+	if (hdr.checksum != checksum(&hdr, buf, size)) {
+		snprintf(why, len, "checksum mismatch (gen %u)", hdr.gen);
+		return -1;
+	}
+	if (hdr.file != (uint32_t)file || hdr.offset != (uint64_t)offset ||
+		hdr.seed != (uint32_t)conf.verify_seed) {
+		snprintf(why, len, "misplaced block of file-%u offset %llu seed %u",
+			hdr.file, (unsigned long long)hdr.offset, hdr.seed);
+		return -1;
+	}
+	if (hdr.gen < min_gen) {
+		snprintf(why, len, "stale block (gen %u, expected %u or later)",
+			hdr.gen, min_gen);
+		return -1;
+	}
+
+	return 0;
+}
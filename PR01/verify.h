@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Data verification
+ * With -V every written block starts with a header stamping where and
+ * when (phase generation) it was written, followed by a pseudo random
+ * payload seeded from those. A checksum over header and payload lets
+ * readers verify a block without regenerating it.
+ */
+#define VERIFY_MIN_SIZE 64
+
+/* generations of blocks, per job & block */
+#define GEN_NONE 0 /* not written by fsbench, not verified */
+#define GEN_UNKNOWN UINT32_MAX /* overwritten by other means, not verified */
+
+void verify_fill(char *buf, size_t size, int file, off_t offset, uint32_t gen);
+
+/* 0 if 'buf' holds the block of 'file' at 'offset' written in generation
+ * 'min_gen' or later, otherwise -1 with the reason in 'why'
+ */
+int verify_check(const char *buf, size_t size, int file, off_t offset,
+	uint32_t min_gen, char *why, size_t len);
@@ -24,6 +24,8 @@
   gcc -Wall `pkg-config fuse --cflags --libs` -o bbfs bbfs.c
 */
 
+#define _GNU_SOURCE // O_PATH
+
 #include "params.h"
 
 #include <ctype.h>
@@ -38,6 +40,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <linux/fs.h>
 
 #ifdef HAVE_SYS_XATTR_H
 #include <sys/xattr.h>
@@ -46,6 +49,8 @@
 #include "log.h"
 #include "encryption.h"
 #include "buffer.h"
+#include "compression.h"
+#include "bbfs_ioctl.h"
 
 // Check whether the given user is permitted to perform the given operation on the given 
 
@@ -84,7 +89,7 @@ int bb_getattr(const char *path, struct stat *statbuf)
 		path, statbuf);
 	bb_fullpath(fpath, path);
 	
-	retstat = lstat(fpath, statbuf);
+	retstat = buf_lstat(fpath, statbuf);
 	if (retstat != 0)
 		retstat = log_error("bb_getattr lstat");
 	
@@ -187,14 +192,21 @@ int bb_unlink(const char *path)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct stat statbuf;
+	int gone;
 	
 	log_msg("bb_unlink(path=\"%s\")\n",
 		path);
 	bb_fullpath(fpath, path);
+
+	// inode number may be reused once it is unlinked
+	gone = lstat(fpath, &statbuf) == 0;
 	
 	retstat = unlink(fpath);
 	if (retstat < 0)
 		retstat = log_error("bb_unlink unlink");
+	else if (gone)
+		buf_forget(&statbuf);
 	
 	return retstat;
 }
@@ -244,15 +256,22 @@ int bb_rename(const char *path, const char *newpath)
 	int retstat = 0;
 	char fpath[PATH_MAX];
 	char fnewpath[PATH_MAX];
+	struct stat statbuf;
+	int replaced;
 	
 	log_msg("\nbb_rename(fpath=\"%s\", newpath=\"%s\")\n",
 		path, newpath);
 	bb_fullpath(fpath, path);
 	bb_fullpath(fnewpath, newpath);
+
+	// inode number of a replaced file may be reused
+	replaced = lstat(fnewpath, &statbuf) == 0;
 	
 	retstat = rename(fpath, fnewpath);
 	if (retstat < 0)
 		retstat = log_error("bb_rename rename");
+	else if (replaced)
+		buf_forget(&statbuf);
 	
 	return retstat;
 }
@@ -314,11 +333,33 @@ int bb_chown(const char *path, uid_t uid, gid_t gid)
 int bb_truncate(const char *path, off_t newsize)
 {
 	int retstat = 0;
+	int fd;
 	char fpath[PATH_MAX];
+	struct stat statbuf;
 	
 	log_msg("\nbb_truncate(path=\"%s\", newsize=%lld)\n",
 		path, newsize);
 	bb_fullpath(fpath, path);
+
+	// a packed file is cut in its block index, which needs an fd
+	if (BB_DATA->cmp_mode) {
+		fd = open(fpath, O_WRONLY);
+		if (fd < 0)
+			return log_error("bb_truncate open");
+
+		retstat = buf_open(fd);
+		if (retstat == 0)
+			retstat = buf_ftruncate(fd, newsize);
+		if (retstat < 0)
+			log_msg("    ERROR bb_truncate: %s\n", strerror(-retstat));
+		buf_close(fd);
+
+		return retstat;
+	}
+
+	// blocks cached under any open fd have to be on disk before cutting them
+	if (stat(fpath, &statbuf) == 0)
+		buf_truncate(&statbuf);
 	
 	retstat = truncate(fpath, newsize);
 	if (retstat < 0)
@@ -368,6 +409,8 @@ int bb_open(const char *path, struct fuse_file_info *fi)
 	fd = open(fpath, fi->flags);
 	if (fd < 0)
 		retstat = log_error("bb_open open");
+	else if ((retstat = buf_open(fd)) < 0)
+		close(fd);
 	
 	fi->fh = fd;
 	log_fi(fi);
@@ -560,6 +603,9 @@ int bb_fsync(const char *path, int datasync, struct fuse_file_info *fi)
 	log_msg("\nbb_fsync(path=\"%s\", datasync=%d, fi=0x%08x)\n",
 		path, datasync, fi);
 	log_fi(fi);
+
+	// cached blocks & block index of a packed file reach the disk first
+	buf_flush(fi->fh);
 	
 	// some unix-like systems (notably freebsd) don't have a datasync call
 #ifdef HAVE_FDATASYNC
@@ -801,6 +847,12 @@ void *bb_init(struct fuse_conn_info *conn)
 	
 	log_conn(conn);
 	log_fuse_context(fuse_get_context());
+
+	// holes read as encrypted zeros, no request has been served yet
+	if (enc_init_zero_block() < 0) {
+		fprintf(stderr, "cannot build encrypted zero block\n");
+		abort();
+	}
 	
 	return BB_DATA;
 }
@@ -815,6 +867,8 @@ void *bb_init(struct fuse_conn_info *conn)
 void bb_destroy(void *userdata)
 {
 	log_msg("\nbb_destroy(userdata=0x%08x)\n", userdata);
+
+	buf_log_stats();
 }
 
 /**
@@ -870,6 +924,8 @@ int bb_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 	fd = creat(fpath, mode);
 	if (fd < 0)
 		retstat = log_error("bb_create creat");
+	else if ((retstat = buf_open(fd)) < 0)
+		close(fd);
 	
 	fi->fh = fd;
 	
@@ -898,9 +954,10 @@ int bb_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi)
 		path, offset, fi);
 	log_fi(fi);
 	
-	retstat = ftruncate(fi->fh, offset);
+	// flushes cached blocks first, packed files are cut in their index
+	retstat = buf_ftruncate(fi->fh, offset);
 	if (retstat < 0)
-		retstat = log_error("bb_ftruncate ftruncate");
+		log_msg("    ERROR bb_ftruncate: %s\n", strerror(-retstat));
 	
 	return retstat;
 }
@@ -932,7 +989,7 @@ int bb_fgetattr(const char *path, struct stat *statbuf, struct fuse_file_info *f
 	if (!strcmp(path, "/"))
 		return bb_getattr(path, statbuf);
 	
-	retstat = fstat(fi->fh, statbuf);
+	retstat = buf_fstat(fi->fh, statbuf);
 	if (retstat < 0)
 		retstat = log_error("bb_fgetattr fstat");
 	
@@ -941,6 +998,206 @@ int bb_fgetattr(const char *path, struct stat *statbuf, struct fuse_file_info *f
 	return retstat;
 }
 
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(2, 8)
+// Returns 0 if descriptor 'fd' of the calling process was opened
+// for the access mode in 'flags'.  /proc/<pid>/fdinfo tells, and
+// refuses O_PATH descriptors, which give no access at all.
+static int bb_check_caller_fd(int64_t fd, int flags)
+{
+	char proc[64];
+	char line[128];
+	unsigned int fdflags;
+	int found = 0;
+	FILE *fp;
+
+	snprintf(proc, sizeof(proc), "/proc/%d/fdinfo/%lld",
+		fuse_get_context()->pid, (long long)fd);
+	fp = fopen(proc, "r");
+	if (fp == NULL)
+		return log_error("bb_check_caller_fd fopen");
+	while (!found && fgets(line, sizeof(line), fp) != NULL)
+		found = sscanf(line, "flags: %o", &fdflags) == 1;
+	fclose(fp);
+
+	if (!found || (fdflags & O_PATH))
+		return -EBADF;
+	if ((flags & O_ACCMODE) != O_WRONLY && (fdflags & O_ACCMODE) == O_WRONLY)
+		return -EBADF;
+	if ((flags & O_ACCMODE) != O_RDONLY && (fdflags & O_ACCMODE) == O_RDONLY)
+		return -EBADF;
+
+	return 0;
+}
+
+// Opens the backing file of descriptor 'fd' of the calling process.
+// The caller's fd table is only reachable through /proc, and the
+// file has to live in this mount.  bbfs opens it by path with its
+// own credentials, so the caller's fd must allow the same access.
+static int bb_open_caller_fd(int64_t fd, int flags)
+{
+	char proc[64];
+	char link[PATH_MAX];
+	char fpath[PATH_MAX];
+	size_t mlen;
+	ssize_t len;
+	int retstat;
+	int backing_fd;
+
+	if (BB_DATA->mountdir == NULL)
+		return -EXDEV;
+	mlen = strlen(BB_DATA->mountdir);
+
+	retstat = bb_check_caller_fd(fd, flags);
+	if (retstat < 0)
+		return retstat;
+
+	snprintf(proc, sizeof(proc), "/proc/%d/fd/%lld",
+		fuse_get_context()->pid, (long long)fd);
+	len = readlink(proc, link, sizeof(link) - 1);
+	if (len < 0)
+		return log_error("bb_open_caller_fd readlink");
+	link[len] = '\0';
+
+	if (strncmp(link, BB_DATA->mountdir, mlen) != 0 || link[mlen] != '/')
+		return -EXDEV;
+
+	bb_fullpath(fpath, link + mlen);
+	backing_fd = open(fpath, flags);
+	if (backing_fd < 0)
+		return log_error("bb_open_caller_fd open");
+
+	retstat = buf_open(backing_fd);
+	if (retstat < 0) {
+		close(backing_fd);
+		return retstat;
+	}
+
+	return backing_fd;
+}
+
+/**
+ * Ioctl
+ *
+ * flags will have FUSE_IOCTL_COMPAT set for 32bit ioctls in
+ * 64bit environment.  The size and direction of data is
+ * determined by _IOC_*() decoding of cmd.  For _IOC_NONE,
+ * data will be NULL, for _IOC_WRITE data is out area, for
+ * _IOC_READ in area and if both are set in/out area.  In all
+ * non-NULL cases, the area is of _IOC_SIZE(cmd) bytes.
+ *
+ * Introduced in version 2.8
+ */
+int bb_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+	unsigned int flags, void *data)
+{
+	int retstat = 0;
+	int src_fd;
+	ssize_t copied;
+	off_t off;
+	struct bbfs_copy_range *range;
+	struct bbfs_seek *seek;
+	
+	log_msg("\nbb_ioctl(path=\"%s\", cmd=0x%08x, arg=0x%08x, fi=0x%08x, flags=0x%08x, data=0x%08x)\n",
+		path, cmd, arg, fi, flags, data);
+	log_fi(fi);
+
+	if (flags & FUSE_IOCTL_COMPAT)
+		return -ENOSYS;
+
+	// SEEK_DATA / SEEK_HOLE, FUSE 2.x doesn't forward lseek()
+	if ((unsigned int)cmd == BBFS_IOC_SEEK) {
+		seek = data;
+
+		if (seek->whence != SEEK_DATA && seek->whence != SEEK_HOLE)
+			return -EINVAL;
+
+		off = buf_seek(fi->fh, seek->offset, seek->whence);
+		if (off < 0)
+			return -errno; // ENXIO: no data / hole past offset
+		seek->offset = off;
+
+		return 0;
+	}
+
+	// server-side copy into this file
+	if ((unsigned int)cmd == BBFS_IOC_COPY_RANGE) {
+		range = data;
+		range->copied = 0;
+
+		if ((fi->flags & O_ACCMODE) == O_RDONLY)
+			return -EBADF;
+
+		src_fd = bb_open_caller_fd(range->src_fd, O_RDONLY);
+		if (src_fd < 0)
+			return src_fd;
+
+		copied = buf_copy_range(src_fd, range->src_offset, fi->fh,
+			range->dest_offset,
+			range->src_length ? range->src_length : (size_t)-1);
+		if (copied < 0)
+			retstat = copied;
+		else // may not fit in the int ioctl() returns
+			range->copied = copied;
+		buf_close(src_fd);
+
+		return retstat;
+	}
+
+	// stored bytes differ from file contents, the backing fs
+	// can't answer on behalf of bbfs
+	if (enc_is_enabled())
+		return -ENOTTY;
+
+	// only queries whose argument is the buffer FUSE copied for us,
+	// 'arg' points into the caller and is never passed on.  Setters
+	// are left out, they would run with the credentials of bbfs
+	switch ((unsigned int)cmd) {
+	case FS_IOC_GETFLAGS:
+	case FS_IOC_GETVERSION:
+#ifdef FS_IOC_FSGETXATTR
+	case FS_IOC_FSGETXATTR:
+#endif
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	retstat = ioctl(fi->fh, cmd, data);
+	if (retstat < 0)
+		retstat = log_error("bb_ioctl ioctl");
+	
+	return retstat;
+}
+#endif
+
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(2, 9)
+/**
+ * Allocates space for an open file
+ *
+ * This function ensures that required space is allocated for specified
+ * file.  If this function returns success then any subsequent write
+ * request to specified range is guaranteed not to fail because of lack
+ * of space on the file system media.
+ *
+ * Introduced in version 2.9.1
+ */
+int bb_fallocate(const char *path, int mode, off_t offset, off_t len,
+	struct fuse_file_info *fi)
+{
+	int retstat = 0;
+	
+	log_msg("\nbb_fallocate(path=\"%s\", mode=0x%x, offset=%lld, len=%lld, fi=0x%08x)\n",
+		path, mode, offset, len, fi);
+	log_fi(fi);
+
+	retstat = buf_fallocate(fi->fh, mode, offset, len);
+	if (retstat < 0)
+		log_msg("    ERROR bb_fallocate: %s\n", strerror(-retstat));
+	
+	return retstat;
+}
+#endif
+
 struct fuse_operations bb_oper = {
 	.getattr = bb_getattr,
 	.readlink = bb_readlink,
@@ -982,7 +1239,13 @@ struct fuse_operations bb_oper = {
 	.access = bb_access,
 	.create = bb_create,
 	.ftruncate = bb_ftruncate,
-	.fgetattr = bb_fgetattr
+	.fgetattr = bb_fgetattr,
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(2, 8)
+	.ioctl = bb_ioctl,
+#endif
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(2, 9)
+	.fallocate = bb_fallocate,
+#endif
 };
 
 void bb_usage()
@@ -1027,6 +1290,8 @@ int main(int argc, char *argv[])
 	// Pull the rootdir out of the argument list and save it in my
 	// internal data
 	bb_data->rootdir = realpath(argv[argc-2], NULL);
+	// and the mountpoint, to find our files behind other processes' fds
+	bb_data->mountdir = realpath(argv[argc-1], NULL);
 	argv[argc-2] = argv[argc-1];
 	argv[argc-1] = NULL;
 	argc--;
@@ -1034,6 +1299,15 @@ int main(int argc, char *argv[])
 	bb_data->logfile = log_open();
 	enc_get_keys(&bb_data->key_add, &bb_data->key_shift);
 	buf_get_policy(&bb_data->buf_policy);
+	buf_get_dedup(&bb_data->buf_dedup);
+	buf_get_cache_size(&bb_data->buf_chunks);
+	cmp_get_mode(&bb_data->cmp_mode);
+
+	if (bb_data->buf_policy != 0 && buf_init(bb_data->buf_chunks) < 0) {
+		fprintf(stderr, "cannot allocate %u KB of buffer cache\n",
+			bb_data->buf_chunks * 4);
+		return 1;
+	}
 
 	/* initialize rand() seed */
 	srand(time(NULL));
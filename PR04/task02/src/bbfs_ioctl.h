@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+/* ioctl()s understood by bbfs
+ * FUSE 2.x has no copy_file_range, so applications (e.g. cp) ask
+ * bbfs for a server-side copy through this interface instead:
+ *
+ *   struct bbfs_copy_range range = { src_fd, 0, 0, 0 };
+ *   ioctl(dest_fd, BBFS_IOC_COPY_RANGE, &range);
+ *   // range.copied bytes were copied
+ *
+ * Both files must live in the same bbfs mount, src_fd open for
+ * reading and dest_fd for writing.
+ *
+ * Neither is lseek() forwarded, SEEK_DATA / SEEK_HOLE are asked for
+ * with BBFS_IOC_SEEK:
+ *
+ *   struct bbfs_seek seek = { offset, SEEK_DATA };
+ *   ioctl(fd, BBFS_IOC_SEEK, &seek);
+ *   // seek.offset is next data, fails with ENXIO if there is none
+ */
+
+#define BBFS_IOC_MAGIC 0xbb
+
+// starts with the layout of struct file_clone_range (FICLONERANGE)
+struct bbfs_copy_range {
+    int64_t src_fd;
+    uint64_t src_offset;
+    uint64_t src_length; // 0: up to end of source
+    uint64_t dest_offset;
+    uint64_t copied; // out: bytes copied, less than asked at end of source
+};
+
+#define BBFS_IOC_COPY_RANGE _IOWR(BBFS_IOC_MAGIC, 1, struct bbfs_copy_range)
+
+struct bbfs_seek {
+    int64_t offset; // in: where to start, out: next data or hole
+    int32_t whence; // SEEK_DATA or SEEK_HOLE
+    int32_t pad;
+};
+
+#define BBFS_IOC_SEEK _IOWR(BBFS_IOC_MAGIC, 2, struct bbfs_seek)
@@ -1,18 +1,94 @@
+#define _GNU_SOURCE // fallocate(), SEEK_DATA & SEEK_HOLE, loff_t
+
 #include "params.h"
 #include "buffer.h"
+#include "compression.h"
+#include "encryption.h"
 #include "log.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
+#define CHUNK_SIZE (4 * 1024) //4KB
+#define DEFAULT_CACHE_KB 5120 //5MB (1280 chunks)
+#define CHUNK_NONE ((unsigned int)-1) //no chunk attached
+
+/* With dedup enabled, several eviction nodes may share one chunk,
+ * so the queue is allowed to track more nodes than there are chunks.
+ */
+#define DEDUP_NODE_FACTOR 4
+#define DEDUP_HASH_BUCKETS 2048 //must be power of 2
+#define PERSIST_HASH_BUCKETS 2048 //must be power of 2
 
 /* Chunks
  * Each chunk_array[] element has 4KB data
+ * BB_DATA->buf_chunks of them are allocated by buf_init()
  */
 struct chunk_data {
-    unsigned char data[4 * 1024]; //4KB
+    unsigned char data[CHUNK_SIZE];
+};
+static struct chunk_data *chunk_array;
+
+/* Chunk bookkeeping
+ * 'refcount' is the number of eviction nodes pointing to the chunk.
+ * Hashed chunks are chained per bucket of dedup_table[] through
+ * 'next'; free chunks are chained through 'next' as well.
+ */
+struct chunk_meta {
+    unsigned int refcount;
+    unsigned int next;
+    uint64_t hash;
+    int hashed; // 1 if linked into dedup_table[]
+
+    // dedup-on-flush: where this content was last written to disk
+    // chained per bucket of persist_table[] through 'persist_next'
+    int persisted; // 1 if linked into persist_table[]
+    int persist_fd; // fd it was written through, may be closed since
+    dev_t persist_dev;
+    ino_t persist_ino;
+    off_t persist_offset;
+    unsigned int persist_next;
+};
+static struct chunk_meta *chunk_meta;
+
+static struct {
+    unsigned int used; // chunks handed out at least once
+    unsigned int in_use; // chunks currently referenced
+    unsigned int free_head; // list of released chunks
+} chunk_pool = {
+    .used = 0,
+    .in_use = 0,
+    .free_head = CHUNK_NONE,
+};
+
+static unsigned int dedup_table[DEDUP_HASH_BUCKETS] = {
+    [0 ... DEDUP_HASH_BUCKETS - 1] = CHUNK_NONE,
+};
+
+// on-disk copies by (device, inode, offset), one chunk per location
+static unsigned int persist_table[PERSIST_HASH_BUCKETS] = {
+    [0 ... PERSIST_HASH_BUCKETS - 1] = CHUNK_NONE,
 };
-static struct chunk_data chunk_array[1280]; //5MB (1280 * 4KB)
+
+// counters reported by buf_log_stats()
+static struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long dedup_hits;
+    unsigned long flush_writes;
+    unsigned long flush_clones;
+    unsigned long holes_read;
+    unsigned long holes_punched;
+    unsigned long long copy_offloaded; // bytes copied by backing fs
+    unsigned long long copy_blocks; // bytes copied block by block
+} buf_stats;
 
 // Linked List, Queue to manage eviction
 struct eviction_node {
@@ -25,33 +101,40 @@ struct eviction_node {
     unsigned int chunk_index; //index of cached data in chunk_array
 };
 struct eviction_queue {
-    unsigned int occupied_chunks; // occupied chunks
-    unsigned int total_chunks; // total created chunks
-    unsigned int max_chunks; // max possible chunks
+    unsigned int occupied_nodes; // nodes holding cached data
+    unsigned int total_nodes; // total created nodes
     struct eviction_node *front, *rear;
 };
 
 // initialize queue
 static struct eviction_queue evic_queue = {
-    .occupied_chunks = 0,
-    .total_chunks = 0,
-    .max_chunks = 1280, // 0 to 1279
+    .occupied_nodes = 0,
+    .total_nodes = 0,
     .front = NULL,
     .rear = NULL,
 };
 
+// max possible nodes in eviction queue
+static unsigned int _max_nodes
+(void)
+{
+    if (BB_DATA->buf_dedup)
+        return BB_DATA->buf_chunks * DEDUP_NODE_FACTOR;
+    return BB_DATA->buf_chunks;
+}
+
 // returns 1 if eviction queue can be expanded
 static int is_evic_queue_expandable
 (void)
 {
     /*
-     * An expandable queue implies that max_chunks
+     * An expandable queue implies that max nodes
      * have not been utilized yet. At first, we expand the queue
      * as much as possible, after which we follow eviction algorithm.
      * This greatly helps in increasing the performance of high load
      * applications e.g. filesystem benchmarking.
      */
-    return evic_queue.total_chunks < evic_queue.max_chunks;
+    return evic_queue.total_nodes < _max_nodes();
 }
 
 // returns 1 if eviction queue is full
@@ -64,7 +147,7 @@ static int is_evic_queue_full
      * is no longer expandable. In this case, the only way to
      * cache data is to evict existing data.
      */
-    return evic_queue.occupied_chunks >= evic_queue.max_chunks;
+    return evic_queue.occupied_nodes >= _max_nodes();
 }
 
 // print the indexes of cache stored in eviction queue
@@ -81,14 +164,394 @@ static void print_eviction_queue
     log_msg("\n");
 }
 
+// 64-bit FNV-1a over words of a chunk
+// not collision resistant, so every hash match is verified by memcmp()
+static uint64_t _chunk_hash
+(const void *data)
+{
+    const unsigned char *ptr = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t word;
+    size_t i;
+
+    for (i = 0; i < CHUNK_SIZE; i += sizeof(word)) {
+        memcpy(&word, ptr + i, sizeof(word)); // buf may be unaligned
+        hash ^= word;
+        hash *= 0x100000001b3ULL;
+        hash ^= hash >> 32;
+    }
+
+    return hash;
+}
+
+// takes a chunk from free list, or a never used one
+static unsigned int _chunk_alloc
+(void)
+{
+    unsigned int chunk_index;
+
+    if (chunk_pool.free_head != CHUNK_NONE) {
+        chunk_index = chunk_pool.free_head;
+        chunk_pool.free_head = chunk_meta[chunk_index].next;
+    } else if (chunk_pool.used < BB_DATA->buf_chunks) {
+        chunk_index = chunk_pool.used;
+        chunk_pool.used += 1;
+    } else {
+        return CHUNK_NONE; //all chunks are referenced. we must evict
+    }
+
+    chunk_pool.in_use += 1;
+    return chunk_index;
+}
+
+// bucket of persist_table[] for block at 'offset' of file (dev, ino)
+static unsigned int _persist_bucket
+(dev_t dev, ino_t ino, off_t offset)
+{
+    uint64_t key;
+
+    key = ((uint64_t)ino * 31 + dev) * 0x9e3779b97f4a7c15ULL;
+    key += offset / CHUNK_SIZE; // neighbouring blocks, neighbouring buckets
+
+    return (key ^ (key >> 32)) & (PERSIST_HASH_BUCKETS - 1);
+}
+
+// returns chunk whose on-disk copy is at 'offset' of file 'st'
+static unsigned int _persist_lookup
+(const struct stat *st, off_t offset)
+{
+    unsigned int chunk_index;
+
+    chunk_index = persist_table[_persist_bucket(st->st_dev, st->st_ino, offset)];
+    while (chunk_index != CHUNK_NONE) {
+        if (chunk_meta[chunk_index].persist_dev == st->st_dev &&
+            chunk_meta[chunk_index].persist_ino == st->st_ino &&
+            chunk_meta[chunk_index].persist_offset == offset)
+            break;
+        chunk_index = chunk_meta[chunk_index].persist_next;
+    }
+
+    return chunk_index;
+}
+
+// forget on-disk copy of chunk
+static void _persist_unlink
+(unsigned int chunk_index)
+{
+    struct chunk_meta *meta;
+    unsigned int *link;
+
+    if (chunk_index == CHUNK_NONE || !chunk_meta[chunk_index].persisted)
+        return;
+
+    meta = &chunk_meta[chunk_index];
+    link = &persist_table[_persist_bucket(meta->persist_dev, meta->persist_ino,
+                                meta->persist_offset)];
+    while (*link != chunk_index)
+        link = &chunk_meta[*link].persist_next;
+    *link = meta->persist_next;
+    meta->persisted = 0;
+}
+
+// chunk was just written to 'offset' of file 'st' through 'fd'
+// whatever was persisted at this location is overwritten now
+static void _persist_link
+(unsigned int chunk_index, int fd, const struct stat *st, off_t offset)
+{
+    struct chunk_meta *meta = &chunk_meta[chunk_index];
+    unsigned int *bucket;
+
+    _persist_unlink(_persist_lookup(st, offset));
+    _persist_unlink(chunk_index); // only its latest copy is kept
+
+    meta->persist_fd = fd;
+    meta->persist_dev = st->st_dev;
+    meta->persist_ino = st->st_ino;
+    meta->persist_offset = offset;
+
+    bucket = &persist_table[_persist_bucket(st->st_dev, st->st_ino, offset)];
+    meta->persist_next = *bucket;
+    *bucket = chunk_index;
+    meta->persisted = 1;
+}
+
+// forget on-disk copies in file 'st', it changed behind the buffer
+// only for rare calls, it scans all chunks
+static void _persist_forget
+(const struct stat *st)
+{
+    unsigned int i;
+
+    for (i = 0; i < chunk_pool.used; i++) {
+        if (chunk_meta[i].persist_dev == st->st_dev &&
+            chunk_meta[i].persist_ino == st->st_ino)
+            _persist_unlink(i);
+    }
+}
+
+// returns 1 if on-disk copy of chunk can be cloned to 'offset' of 'st'
+static int _persist_clonable
+(unsigned int chunk_index, const struct stat *st, off_t offset)
+{
+    struct chunk_meta *meta = &chunk_meta[chunk_index];
+    struct stat src;
+
+    if (!meta->persisted)
+        return 0;
+
+    // already there
+    if (meta->persist_dev == st->st_dev && meta->persist_ino == st->st_ino &&
+        meta->persist_offset == offset)
+        return 0;
+
+    // fd may have been closed since, or reused for another file
+    if (fstat(meta->persist_fd, &src) < 0 ||
+        src.st_dev != meta->persist_dev || src.st_ino != meta->persist_ino)
+        return 0;
+
+    return 1;
+}
+
+// drops a reference to chunk
+// when no node refers to it anymore, it goes back to free list
+static void _chunk_put
+(unsigned int chunk_index)
+{
+    struct chunk_meta *meta;
+    unsigned int *link;
+
+    if (chunk_index == CHUNK_NONE)
+        return;
+
+    meta = &chunk_meta[chunk_index];
+    meta->refcount -= 1;
+    if (meta->refcount > 0)
+        return;
+
+    // unlink from dedup table
+    if (meta->hashed) {
+        link = &dedup_table[meta->hash & (DEDUP_HASH_BUCKETS - 1)];
+        while (*link != chunk_index)
+            link = &chunk_meta[*link].next;
+        *link = meta->next;
+        meta->hashed = 0;
+    }
+
+    // content is gone, so is its on-disk copy
+    _persist_unlink(chunk_index);
+
+    // add to free list
+    meta->next = chunk_pool.free_head;
+    chunk_pool.free_head = chunk_index;
+    chunk_pool.in_use -= 1;
+}
+
+// shares the extent holding (src_fd, src_offset) with (fd, offset)
+// returns 0 if backing filesystem cloned the block
+static int _clone_block
+(int src_fd, off_t src_offset, int fd, off_t offset)
+{
+#ifdef FICLONERANGE
+    static int clone_unsupported = 0;
+    struct file_clone_range range;
+
+    // payloads of packed files are no blocks of their own
+    if (clone_unsupported || cmp_is_packed(src_fd) || cmp_is_packed(fd))
+        return -1;
+
+    range.src_fd = src_fd;
+    range.src_offset = src_offset;
+    range.src_length = CHUNK_SIZE;
+    range.dest_offset = offset;
+
+    if (ioctl(fd, FICLONERANGE, &range) == 0)
+        return 0;
+
+    // no reflink support, don't try again
+    if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV)
+        clone_unsupported = 1;
+#endif
+    return -1;
+}
+
+// returns length of hole at [offset, offset + count) of backing file:
+// count if it is all hole, less if end of file cuts it short, 0 at or
+// beyond end of file. -1 if the range holds data (or we can't tell)
+// Nothing is remembered, any fd of the file may have written to it.
+static ssize_t _hole_size
+(int fd, off_t offset, size_t count)
+{
+    struct stat statbuf;
+    off_t data;
+
+    if (cmp_is_packed(fd))
+        return cmp_hole_size(fd, offset, count);
+
+    data = lseek(fd, offset, SEEK_DATA);
+    if (data >= 0)
+        return data >= offset + (off_t)count ? (ssize_t)count : -1;
+
+    // SEEK_DATA not supported, assume data
+    if (errno != ENXIO || fstat(fd, &statbuf) < 0)
+        return -1;
+
+    // no data from offset onwards, trailing hole or end of file
+    if (offset >= statbuf.st_size)
+        return 0;
+    if (offset + (off_t)count > statbuf.st_size)
+        return statbuf.st_size - offset;
+    return count;
+}
+
+// turns block (fd, offset) into a hole instead of writing zeros
+static int _punch_block
+(int fd, size_t count, off_t offset)
+{
+    struct stat statbuf;
+
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, count) < 0)
+        return -1;
+
+    // punching never extends a file, but writing the block would have
+    if (fstat(fd, &statbuf) == 0 && statbuf.st_size < offset + (off_t)count) {
+        if (ftruncate(fd, offset + count) < 0)
+            return -1;
+    }
+
+    buf_stats.holes_punched += 1;
+    return 0;
+}
+
+// reads block (fd, offset) from disk
+// packed files are read through their block index
+static ssize_t _disk_read
+(int fd, void *buf, size_t count, off_t offset)
+{
+    if (cmp_is_packed(fd))
+        return cmp_read(fd, buf, count, offset);
+
+    return pread(fd, buf, count, offset);
+}
+
+// writes block (fd, offset) to disk
+// zero blocks become holes
+static ssize_t _disk_write
+(int fd, const void *buf, size_t count, off_t offset)
+{
+    // compressed, or left out of the block index if zero
+    if (cmp_is_packed(fd))
+        return cmp_write(fd, buf, count, offset);
+
+    if (count == CHUNK_SIZE && offset % CHUNK_SIZE == 0 &&
+        memcmp(buf, enc_zero_block(), count) == 0) {
+        if (_punch_block(fd, count, offset) == 0)
+            return count;
+        // no hole punching on backing fs, write zeros
+    }
+
+    return pwrite(fd, buf, count, offset);
+}
+
+// length of the extent at [offset, offset + count) of backing file,
+// *hole tells whether it is a hole or data. -1 if SEEK_DATA isn't supported
+static ssize_t _extent_size
+(int fd, off_t offset, size_t count, int *hole)
+{
+    off_t next;
+
+    next = lseek(fd, offset, SEEK_DATA);
+    if (next < 0) {
+        if (errno != ENXIO)
+            return -1;
+        *hole = 1; // trailing hole
+        return count;
+    }
+
+    *hole = next > offset;
+    if (!*hole) {
+        next = lseek(fd, offset, SEEK_HOLE);
+        if (next < 0)
+            return -1;
+    }
+
+    if (next >= offset + (off_t)count)
+        return count;
+    return next - offset;
+}
+
+// fills [offset, offset + count) of backing file with encrypted zeros,
+// whole blocks become holes. Plain zeros would decrypt to garbage.
+static int _zero_range
+(int fd, off_t offset, size_t count)
+{
+    struct stat statbuf;
+    off_t end = offset + count;
+    size_t size;
+    ssize_t ret;
+    int packed = cmp_is_packed(fd);
+    int punch = !packed; // packed files drop zero blocks themselves
+
+    while (count > 0) {
+        if (punch && offset % CHUNK_SIZE == 0 && count >= CHUNK_SIZE) {
+            size = count - count % CHUNK_SIZE;
+            if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        offset, size) == 0) {
+                buf_stats.holes_punched += size / CHUNK_SIZE;
+                offset += size;
+                count -= size;
+                continue;
+            }
+            // no hole punching on backing fs, write zeros
+            punch = 0;
+        }
+
+        size = CHUNK_SIZE - offset % CHUNK_SIZE;
+        if (size > count)
+            size = count;
+
+        ret = packed ? _disk_write(fd, enc_zero_block(), size, offset) :
+                    pwrite(fd, enc_zero_block(), size, offset);
+        if (ret < 0)
+            return -1;
+        offset += ret;
+        count -= ret;
+    }
+
+    // punching never extends a file, but writing the zeros would have
+    if (!packed && fstat(fd, &statbuf) == 0 && statbuf.st_size < end) {
+        if (ftruncate(fd, end) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+// copy_file_range() of backing fs, may end up as reflink
+// returns -1 & errno set if kernel or fs can't do it
+static ssize_t _copy_file_range
+(int src_fd, off_t src_offset, int fd, off_t offset, size_t count)
+{
+#ifdef __NR_copy_file_range
+    loff_t off_in = src_offset;
+    loff_t off_out = offset;
+
+    return syscall(__NR_copy_file_range, src_fd, &off_in, fd, &off_out, count, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 // allocates a new eviction node and adds it to front of queue
-// chunk_index is monotonically increasing until max_chunks,
-// after which, it is not possible to allocate more nodes.
+// nodes can be allocated until max nodes, after which,
+// it is not possible to allocate more nodes.
 static struct eviction_node *create_new_node
 (int fd, off_t offset, int flags)
 {
     struct eviction_node *node;
-    unsigned int chunk_index;
+
+    if (evic_queue.total_nodes >= _max_nodes())
+        return NULL; //all nodes are now utilized. we must evict
 
     /* allocate memory */
     node = malloc(sizeof(struct eviction_node));
@@ -96,24 +559,17 @@ static struct eviction_node *create_new_node
         log_msg("ERROR: unable to allocate memory");
         return NULL;
     }
-
-    /* assign chunk_index */
-    chunk_index = evic_queue.total_chunks;
-    if (chunk_index >= evic_queue.max_chunks) {
-        free(node);
-        return NULL; //all chunks are now utilized. we must evict
-    }
-    evic_queue.total_chunks += 1; // increment for next allocation
+    evic_queue.total_nodes += 1;
 
     /* initialize */
     node->next = node->prev = NULL;
     node->fd = fd;
     node->offset = offset;
     node->flags = flags;
-    node->chunk_index = chunk_index;
+    node->chunk_index = CHUNK_NONE; // attached by caller
 
-    /* to track number of occupied chunks */
-    evic_queue.occupied_chunks += 1;
+    /* to track number of occupied nodes */
+    evic_queue.occupied_nodes += 1;
 
     /* add to front of queue */
     node->next = evic_queue.front;
@@ -164,8 +620,10 @@ static void _flush_node
 (struct eviction_node *node)
 {
 #define RETRY_COUNT 2
-    ssize_t bytes_written;
+    ssize_t bytes_written = 0;
     int retry = 0;
+    int dedup = 0;
+    struct stat statbuf;
 
     // sanity check
     if (node == NULL || node->fd == -1)
@@ -177,27 +635,54 @@ static void _flush_node
         goto skip_write;
     }
 
+    // dedup-on-flush: same content already on disk, share its extent
+    // copies are tracked by inode, any fd of a file may have written it
+    if (BB_DATA->buf_dedup == 2 && fstat(node->fd, &statbuf) == 0) {
+        dedup = 1;
+        if (_persist_clonable(node->chunk_index, &statbuf, node->offset) &&
+            _clone_block(chunk_meta[node->chunk_index].persist_fd,
+                    chunk_meta[node->chunk_index].persist_offset,
+                    node->fd, node->offset) == 0) {
+            buf_stats.flush_clones += 1;
+            bytes_written = CHUNK_SIZE;
+            goto written;
+        }
+    }
+
     do {
         // flush to disk
-        bytes_written = pwrite(node->fd, chunk_array[node->chunk_index].data,
-                            4096, node->offset); // request size fixed to 4KB
+        bytes_written = _disk_write(node->fd, chunk_array[node->chunk_index].data,
+                            CHUNK_SIZE, node->offset); // request size fixed to 4KB
 
         // success
-        if (bytes_written == 4096)
+        if (bytes_written == CHUNK_SIZE)
             break;
 
         // retry
         log_msg("ERROR : inconsistent write. Retrying...\n");
         retry++;
     } while (retry < RETRY_COUNT);
+    buf_stats.flush_writes += 1;
+
+written:
+    if (dedup) {
+        if (bytes_written == CHUNK_SIZE)
+            _persist_link(node->chunk_index, node->fd, &statbuf, node->offset);
+        else // unknown what is on disk now
+            _persist_unlink(_persist_lookup(&statbuf, node->offset));
+    }
 
 skip_write:
     // invalidate fd
     // so that it can be reused
     node->fd = -1;
 
-    // inform queue about free chunk
-    evic_queue.occupied_chunks -= 1;
+    // release chunk, other nodes may still share it
+    _chunk_put(node->chunk_index);
+    node->chunk_index = CHUNK_NONE;
+
+    // inform queue about free node
+    evic_queue.occupied_nodes -= 1;
 #undef RETRY_COUNT
 }
 
@@ -224,6 +709,143 @@ static void _flush_fd
     }
 }
 
+// flush cached blocks of file 'st', under whichever fd they were cached
+// only for rare calls, it fstat()s the fd of every cached block
+static void _flush_file
+(const struct stat *st)
+{
+    struct eviction_node *iter;
+    struct stat statbuf;
+    int fd = -1, match = 0;
+
+    for (iter = evic_queue.front; iter != NULL; iter = iter->next) {
+        if (iter->fd == -1)
+            continue;
+
+        // same fd as previous node, same answer
+        if (iter->fd != fd) {
+            fd = iter->fd;
+            match = fstat(fd, &statbuf) == 0 && statbuf.st_dev == st->st_dev &&
+                        statbuf.st_ino == st->st_ino;
+        }
+
+        if (match)
+            _flush_node(iter);
+    }
+}
+
+// flush whole buffer to disk
+// a file may be cached under several fds
+static void _flush_all
+(void)
+{
+    struct eviction_node *iter;
+
+    for (iter = evic_queue.front; iter != NULL; iter = iter->next)
+        _flush_node(iter);
+}
+
+// flushes one occupied node (other than 'pinned') so that
+// its chunk may be released. victim is chosen by eviction policy
+// returns -1 if there is nothing left to evict
+static int _evict_for_chunk
+(struct eviction_node *pinned)
+{
+    struct eviction_node *node;
+    unsigned int evic_policy;
+    evic_policy = BB_DATA->buf_policy;
+
+    // LRU, least recently used occupied node
+    if (evic_policy == 2) {
+        node = evic_queue.rear;
+        while (node != NULL && (node->fd == -1 || node == pinned))
+            node = node->prev;
+    }
+    // 1, default => random occupied node
+    else {
+        unsigned int rand_num;
+        struct eviction_node *start;
+
+        if (evic_queue.total_nodes == 0)
+            return -1;
+
+        rand_num = rand() % evic_queue.total_nodes;
+        start = evic_queue.front;
+        while (rand_num > 0) {
+            start = start->next;
+            rand_num -= 1;
+        }
+
+        // walk (circularly) to the next occupied node
+        node = start;
+        while (node->fd == -1 || node == pinned) {
+            node = node->next ? node->next : evic_queue.front;
+            if (node == start) {
+                node = NULL;
+                break;
+            }
+        }
+    }
+
+    if (node == NULL)
+        return -1;
+
+    _flush_node(node);
+    return 0;
+}
+
+// returns index of a chunk holding 'data' with a reference taken
+// with dedup enabled, an identical cached chunk is shared instead
+// of allocating a new one. May evict nodes (except 'pinned') to get
+// a free chunk.
+static unsigned int _chunk_get
+(const void *data, struct eviction_node *pinned)
+{
+    unsigned int chunk_index;
+    unsigned int bucket = 0;
+    uint64_t hash = 0;
+
+    if (BB_DATA->buf_dedup) {
+        hash = _chunk_hash(data);
+        bucket = hash & (DEDUP_HASH_BUCKETS - 1);
+
+        chunk_index = dedup_table[bucket];
+        while (chunk_index != CHUNK_NONE) {
+            // matched, verify content
+            if (chunk_meta[chunk_index].hash == hash &&
+                memcmp(chunk_array[chunk_index].data, data, CHUNK_SIZE) == 0) {
+                chunk_meta[chunk_index].refcount += 1;
+                buf_stats.dedup_hits += 1;
+                return chunk_index;
+            }
+
+            // next
+            chunk_index = chunk_meta[chunk_index].next;
+        }
+    }
+
+    // no identical chunk, allocate a new one
+    while ((chunk_index = _chunk_alloc()) == CHUNK_NONE) {
+        if (_evict_for_chunk(pinned) < 0)
+            return CHUNK_NONE;
+    }
+
+    memcpy(chunk_array[chunk_index].data, data, CHUNK_SIZE);
+    chunk_meta[chunk_index].refcount = 1;
+    chunk_meta[chunk_index].hashed = 0;
+    chunk_meta[chunk_index].persisted = 0;
+
+    // publish for later lookups
+    if (BB_DATA->buf_dedup) {
+        chunk_meta[chunk_index].hash = hash;
+        chunk_meta[chunk_index].next = dedup_table[bucket];
+        chunk_meta[chunk_index].hashed = 1;
+        dedup_table[bucket] = chunk_index;
+    }
+
+    return chunk_index;
+}
+
 // try writing to cache
 // if cache hit, the node will be moved to front of queue
 ssize_t _trywrite_cache
@@ -238,7 +860,15 @@ ssize_t _trywrite_cache
         // matched
         if (iter->fd == fd && iter->offset == offset) {
             // replace data in cache
-            memcpy(chunk_array[iter->chunk_index].data, buf, count);
+            // chunk may be shared, so never modify it in place
+            _chunk_put(iter->chunk_index);
+            iter->chunk_index = _chunk_get(buf, iter);
+            if (iter->chunk_index == CHUNK_NONE) {
+                // no memory, drop the node
+                iter->fd = -1;
+                evic_queue.occupied_nodes -= 1;
+                return -1;
+            }
             bytes_written = count;
             break;
         }
@@ -312,7 +942,7 @@ struct eviction_node *_evict_cached_node
         // that means after invoking this function,
         // the node MUST be utilized for either read or write!
         // otherwise the count will go out of sync
-        evic_queue.occupied_chunks += 1;
+        evic_queue.occupied_nodes += 1;
 
         // move to front (LRU algorithm)
         _move_node_to_front(evic_queue.rear);
@@ -327,14 +957,14 @@ struct eviction_node *_evict_cached_node
         // assume node to evict is front node
         node = evic_queue.front;
 
-        // find a random number between [0 - 1279]
+        // find a random number between [0 - (total_nodes - 1)]
         // at this point, it is okay to assume there are no
         // holes left inside the queue (fd = -1). And each
-        // chunks is referred by one eviction_node.
+        // node refers to a chunk.
         // This is true because at first we expand & utilize the queue
         // to it's maximum. We call eviction algorithm only when
         // there is not enough space left to accommodate more requests
-        rand_num = rand() % evic_queue.max_chunks;
+        rand_num = rand() % evic_queue.total_nodes;
 
         // find node to be evicted
         while (rand_num > 0) {
@@ -349,7 +979,7 @@ struct eviction_node *_evict_cached_node
         // that means after invoking this function,
         // the node MUST be utilized for either read or write!
         // otherwise the count will go out of sync
-        evic_queue.occupied_chunks += 1;
+        evic_queue.occupied_nodes += 1;
         return node;
     }
 
@@ -391,7 +1021,7 @@ struct eviction_node *_find_usable_node
         // that means after invoking this function,
         // the node MUST be utilized for either read or write!
         // otherwise the count will go out of sync
-        evic_queue.occupied_chunks += 1;
+        evic_queue.occupied_nodes += 1;
 
         // LRU?
         if (evic_policy == 2) {
@@ -403,6 +1033,60 @@ struct eviction_node *_find_usable_node
     return NULL;
 }
 
+// caches 'buf' as block (fd, offset) on a cache miss
+// returns < 0 if no memory could be found
+static int _cache_block
+(int fd, const void *buf, off_t offset, int flags)
+{
+    struct eviction_node *node = NULL;
+    unsigned int chunk_index;
+
+    log_msg("\nQueue Status: occupied [%u] total [%u] max [%u] chunks [%u]\n",
+        evic_queue.occupied_nodes, evic_queue.total_nodes, _max_nodes(),
+        chunk_pool.in_use);
+
+    // find memory for data first, it may evict some nodes
+    chunk_index = _chunk_get(buf, NULL);
+    if (chunk_index == CHUNK_NONE) {
+        log_msg("ERROR : unable to find usable memory...\n");
+        return -1;
+    }
+
+    // expand queue if possible
+    if (is_evic_queue_expandable()) {
+        log_msg("Expandable Cache\n");
+        node = create_new_node(fd, offset, flags);
+    }
+    // buffer full, evict
+    else if (is_evic_queue_full()) {
+        log_msg("Eviction Cache\n");
+        node = _evict_cached_node(); //returns evicted node
+    }
+    // buffer available, reuse
+    else {
+        log_msg("Re-usable Cache\n");
+        node = _find_usable_node();
+    }
+
+    if (node == NULL) {
+        log_msg("ERROR : unable to find usable memory...\n");
+        _chunk_put(chunk_index);
+        return -1;
+    }
+
+#ifdef HEX_DUMP_ENABLE
+    print_eviction_queue();
+    log_msg("chunk_index of node: %u\n", chunk_index);
+#endif
+
+    // add to cache
+    node->fd = fd;
+    node->offset = offset;
+    node->flags = flags;
+    node->chunk_index = chunk_index;
+    return 0;
+}
+
 void buf_get_policy
 (unsigned int *buf_policy)
 {
@@ -433,6 +1117,82 @@ void buf_get_policy
     *buf_policy = _buf_policy;
 }
 
+void buf_get_dedup
+(unsigned int *buf_dedup)
+{
+    FILE *fp_conf;
+    unsigned int _buf_dedup = 0;
+
+    //sanity check
+    if (buf_dedup == NULL)
+        return;
+
+    // open file
+    fp_conf = fopen("ee516.conf", "r");
+
+    if (fp_conf != NULL) {
+        int matched;
+
+        // read dedup mode (3rd line)
+        matched = fscanf(fp_conf, "%*[^\n]\n%*[^\n]\n%u", &_buf_dedup);
+
+        // ensure read correctly
+        if (matched != 1 || _buf_dedup > 2)
+            _buf_dedup = 0;
+
+        // close file
+        fclose(fp_conf);
+    }
+
+    *buf_dedup = _buf_dedup;
+}
+
+void buf_get_cache_size
+(unsigned int *buf_chunks)
+{
+    FILE *fp_conf;
+    unsigned int cache_kb = DEFAULT_CACHE_KB;
+
+    //sanity check
+    if (buf_chunks == NULL)
+        return;
+
+    // open file
+    fp_conf = fopen("ee516.conf", "r");
+
+    if (fp_conf != NULL) {
+        int matched;
+
+        // read cache size in KB (4th line)
+        matched = fscanf(fp_conf, "%*[^\n]\n%*[^\n]\n%*[^\n]\n%u", &cache_kb);
+
+        // ensure read correctly
+        if (matched != 1 || cache_kb < CHUNK_SIZE / 1024)
+            cache_kb = DEFAULT_CACHE_KB;
+
+        // close file
+        fclose(fp_conf);
+    }
+
+    *buf_chunks = cache_kb / (CHUNK_SIZE / 1024);
+}
+
+int buf_init
+(unsigned int buf_chunks)
+{
+    chunk_array = malloc(sizeof(struct chunk_data) * buf_chunks);
+    chunk_meta = calloc(buf_chunks, sizeof(struct chunk_meta));
+    if (chunk_array == NULL || chunk_meta == NULL) {
+        free(chunk_array);
+        free(chunk_meta);
+        chunk_array = NULL;
+        chunk_meta = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
 /* Buffer hit:
  *    Return contents
  * Buffer miss:
@@ -444,56 +1204,44 @@ ssize_t buf_read
 {
 #define RETRY_COUNT 2
     unsigned int evic_policy;
-    ssize_t bytes_read;
-    int retry;
-    struct eviction_node *node = NULL;
+    ssize_t bytes_read, hole;
+    int retry = 0;
 
     evic_policy = BB_DATA->buf_policy;
     if (evic_policy == 0) { //no buffer
         log_msg("No  buffer\n");
-        return pread(fd, buf, count, offset);
+        hole = count == CHUNK_SIZE ? _hole_size(fd, offset, count) : -1;
+        if (hole >= 0) {
+            buf_stats.holes_read += 1;
+            memcpy(buf, enc_zero_block(), hole);
+            return hole;
+        }
+        return _disk_read(fd, buf, count, offset);
     }
 
     // check buffer
     if (_tryread_cache(fd, buf, count, offset) == count) {
         log_msg("Cache HIT\n");
+        buf_stats.hits += 1;
         return count;
     }
 
     log_msg("Cache MISS\n");
-
-    log_msg("\nQueue Status: occupied [%u] total [%u] max [%u]\n",
-        evic_queue.occupied_chunks, evic_queue.total_chunks, evic_queue.max_chunks);
-
-    // expand queue if possible
-    if (is_evic_queue_expandable()) {
-        log_msg("Expandable Cache\n");
-        node = create_new_node(fd, offset, flags);
-    }
-    // buffer full, evict
-    else if (is_evic_queue_full()) {
-        log_msg("Eviction Cache\n");
-        node = _evict_cached_node(); //returns evicted node
-    }
-    // buffer available, reuse
-    else {
-        log_msg("Re-usable Cache\n");
-        node = _find_usable_node();
+    buf_stats.misses += 1;
+
+    // holes are served from shared zero block, never cached
+    // nothing is read at end of file
+    hole = count == CHUNK_SIZE ? _hole_size(fd, offset, count) : -1;
+    if (hole >= 0) {
+        log_msg("Hole\n");
+        buf_stats.holes_read += 1;
+        memcpy(buf, enc_zero_block(), hole);
+        return hole;
     }
 
-    if (node == NULL) {
-        log_msg("ERROR : unable to find usable memory...\n");
-        return -1;
-    }
-
-#ifdef HEX_DUMP_ENABLE
-    print_eviction_queue();
-    log_msg("chunk_index of node: %u\n", node->chunk_index);
-#endif
-
     do {
         // read from disk
-        bytes_read = pread(fd, buf, count, offset);
+        bytes_read = _disk_read(fd, buf, count, offset);
 
         // success
         if (bytes_read == count)
@@ -504,11 +1252,15 @@ ssize_t buf_read
         retry++;
     } while (retry < RETRY_COUNT);
 
+    // error, or a partial block at end of file
+    // caching it would write a whole block back on flush
+    if (bytes_read != count)
+        return bytes_read;
+
     // add to cache
-    node->fd = fd;
-    node->offset = offset;
-    node->flags = flags;
-    memcpy(chunk_array[node->chunk_index].data, buf, count);
+    if (_cache_block(fd, buf, offset, flags) < 0)
+        return -1;
+
     return count;
 #undef RETRY_COUNT
 }
@@ -523,60 +1275,41 @@ ssize_t buf_write
 (int fd, const void *buf, size_t count, off_t offset, int flags)
 {
     unsigned int evic_policy;
-    struct eviction_node *node = NULL;
 
     evic_policy = BB_DATA->buf_policy;
     if (evic_policy == 0) { //no buffer
         log_msg("No  buffer\n");
-        return pwrite(fd, buf, count, offset);
+        return _disk_write(fd, buf, count, offset);
     }
 
     // check buffer
     if (_trywrite_cache(fd, buf, count, offset) == count) {
         log_msg("Cache HIT\n");
+        buf_stats.hits += 1;
         return count;
     }
 
     log_msg("Cache MISS\n");
-
-    log_msg("\nQueue Status: occupied [%u] total [%u] max [%u]\n",
-        evic_queue.occupied_chunks, evic_queue.total_chunks, evic_queue.max_chunks);
-
-    // expand queue if possible
-    if (is_evic_queue_expandable()) {
-        log_msg("Expandable Cache\n");
-        node = create_new_node(fd, offset, flags);
-    }
-    // buffer full, evict
-    else if (is_evic_queue_full()) {
-        log_msg("Eviction Cache\n");
-        node = _evict_cached_node(); //returns evicted node
-    }
-    // buffer available, reuse
-    else {
-        log_msg("Re-usable Cache\n");
-        node = _find_usable_node();
-    }
-
-    if (node == NULL) {
-        log_msg("ERROR : unable to find usable memory...\n");
-        return -1;
-    }
-
-#ifdef HEX_DUMP_ENABLE
-    print_eviction_queue();
-    log_msg("chunk_index of node: %u\n", node->chunk_index);
-#endif
+    buf_stats.misses += 1;
 
     // add to cache
     // it will be flushed to disk on eviction
-    node->fd = fd;
-    node->offset = offset;
-    node->flags = flags;
-    memcpy(chunk_array[node->chunk_index].data, buf, count);
+    if (_cache_block(fd, buf, offset, flags) < 0)
+        return -1;
+
     return count;
 }
 
+/*
+ * Backing file was just opened as 'fd'
+ * Packed files are tracked from here on, until buf_close()
+*/
+int buf_open
+(int fd)
+{
+    return cmp_open(fd);
+}
+
 /*
  * According to the assignment, close() / release() is the right
  * place for flushing the data. However, it is not. In practice,
@@ -588,6 +1321,7 @@ ssize_t buf_write
 int buf_close
 (int fd)
 {
+    cmp_close(fd);
     return close(fd);
 }
 
@@ -605,11 +1339,299 @@ int buf_flush
         return -1;
 
     evic_policy = BB_DATA->buf_policy;
-    if (evic_policy == 0) { //no buffer
+    if (evic_policy == 0) //no buffer
         log_msg("No  buffer\n");
+    else
+        _flush_fd(fd);
+
+    // block index of a packed file, after the blocks it points to
+    return cmp_flush(fd);
+}
+
+/*
+ * File 'statbuf' is about to be cut behind the buffer. Its cached
+ * blocks, under any fd, are written back first, or a later eviction
+ * would regrow the file. Its on-disk copies can no longer be used for
+ * dedup-on-flush.
+*/
+void buf_truncate
+(const struct stat *statbuf)
+{
+    if (BB_DATA->buf_policy != 0)
+        _flush_file(statbuf);
+    if (BB_DATA->buf_dedup == 2)
+        _persist_forget(statbuf);
+}
+
+/*
+ * ftruncate() of backing file
+ * Packed files are cut in their block index, raw ones on disk
+ * returns -errno
+*/
+int buf_ftruncate
+(int fd, off_t size)
+{
+    struct stat statbuf;
+
+    // cached blocks have to be on disk before cutting them,
+    // also those of other fds of the file
+    if (fstat(fd, &statbuf) == 0)
+        buf_truncate(&statbuf);
+    else
+        buf_flush(fd);
+
+    if (cmp_truncate(fd, size) < 0)
+        return -errno;
+    return 0;
+}
+
+/*
+ * File 'statbuf' is gone (unlink, rename over it), its inode number
+ * may be reused by a new file
+*/
+void buf_forget
+(const struct stat *statbuf)
+{
+    if (BB_DATA->buf_dedup == 2)
+        _persist_forget(statbuf);
+}
+
+/*
+ * lstat() / fstat() of backing file
+ * st_size of a packed file is the size seen through bbfs
+*/
+int buf_lstat
+(const char *fpath, struct stat *statbuf)
+{
+    return cmp_lstat(fpath, statbuf);
+}
+
+int buf_fstat
+(int fd, struct stat *statbuf)
+{
+    return cmp_fstat(fd, statbuf);
+}
+
+/*
+ * SEEK_DATA / SEEK_HOLE
+ * cached blocks of 'fd' are flushed first, so that the backing
+ * file tells the truth about its holes
+*/
+off_t buf_seek
+(int fd, off_t offset, int whence)
+{
+    if (BB_DATA->buf_policy != 0)
+        _flush_fd(fd);
+
+    if (cmp_is_packed(fd))
+        return cmp_seek(fd, offset, whence);
+    return lseek(fd, offset, whence);
+}
+
+/*
+ * fallocate() on backing file
+ * Without encryption, bytes on disk are file contents
+ * and the backing fs does all the work. Otherwise zeroed ranges must
+ * read back as encrypted zeros: whole blocks become holes (served
+ * from the zero block), partial blocks get encrypted zero bytes.
+*/
+int buf_fallocate
+(int fd, int mode, off_t offset, off_t len)
+{
+    const unsigned char *zero = enc_zero_block();
+    struct stat statbuf;
+    off_t end = offset + len;
+    off_t head, tail, pos;
+
+    // cached blocks would overwrite the range later on
+    if (BB_DATA->buf_policy != 0)
+        _flush_fd(fd);
+    if (BB_DATA->buf_dedup == 2 && fstat(fd, &statbuf) == 0)
+        _persist_forget(&statbuf);
+
+    // only the block index knows where a packed file's blocks are
+    if (cmp_is_packed(fd))
+        return cmp_fallocate(fd, mode, offset, len);
+
+    // stored as is, or preallocation only (new extents read as holes)
+    if (!enc_is_enabled() || (mode & ~FALLOC_FL_KEEP_SIZE) == 0) {
+        if (fallocate(fd, mode, offset, len) < 0)
+            return -errno;
         return 0;
     }
 
-    _flush_fd(fd);
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+        return -EOPNOTSUPP;
+
+    if (fstat(fd, &statbuf) < 0)
+        return -errno;
+
+    // nothing to zero beyond end of file, if it keeps its size
+    if ((mode & FALLOC_FL_KEEP_SIZE) && end > statbuf.st_size)
+        end = statbuf.st_size;
+
+    if (offset < end) {
+        // [head, tail) covers whole blocks
+        head = (offset + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+        tail = end / CHUNK_SIZE * CHUNK_SIZE;
+        if (head > end)
+            head = end;
+        if (tail < head)
+            tail = head;
+
+        // partial blocks, holes already read as zeros
+        // every byte of zero block decrypts to zero
+        if (offset < head &&
+            _hole_size(fd, offset / CHUNK_SIZE * CHUNK_SIZE, CHUNK_SIZE) < 0 &&
+            pwrite(fd, zero, head - offset, offset) < 0)
+            return -errno;
+        if (tail < end &&
+            _hole_size(fd, tail, CHUNK_SIZE) < 0 &&
+            pwrite(fd, zero, end - tail, tail) < 0)
+            return -errno;
+
+        if (head < tail && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                head, tail - head) < 0) {
+            // no hole punching on backing fs, write zeros
+            for (pos = head; pos < tail; pos += CHUNK_SIZE) {
+                if (pwrite(fd, zero, CHUNK_SIZE, pos) < 0)
+                    return -errno;
+            }
+        }
+    }
+
+    // range past old end of file is a hole, reads as zeros
+    if (!(mode & FALLOC_FL_KEEP_SIZE) && statbuf.st_size < end) {
+        if (ftruncate(fd, end) < 0)
+            return -errno;
+    }
+
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Server-side copy, data never travels to the client
+ * Encryption doesn't depend on position, so stored bytes are copied
+ * verbatim, preferably by the backing fs itself (copy_file_range,
+ * reflink).
+ * returns bytes copied
+*/
+ssize_t buf_copy_range
+(int src_fd, off_t src_offset, int fd, off_t offset, size_t count)
+{
+    unsigned char block[CHUNK_SIZE];
+    struct stat src_stat, statbuf;
+    size_t copied = 0, size;
+    ssize_t ret;
+    int hole = 0;
+    // stored bytes of packed files aren't the file contents
+    int offload = !cmp_is_packed(src_fd) && !cmp_is_packed(fd);
+    // holes of an encrypted raw source read as plain zeros, never copy them
+    int sparse = enc_is_enabled() && !cmp_is_packed(src_fd);
+
+    if (cmp_fstat(src_fd, &src_stat) < 0 || cmp_fstat(fd, &statbuf) < 0)
+        return -errno;
+
+    // don't read past end of source
+    if (src_offset >= src_stat.st_size)
+        return 0;
+    if (count > (size_t)(src_stat.st_size - src_offset))
+        count = src_stat.st_size - src_offset;
+
+    // overlapping ranges of one file
+    if (src_stat.st_dev == statbuf.st_dev && src_stat.st_ino == statbuf.st_ino &&
+        src_offset < offset + (off_t)count && offset < src_offset + (off_t)count)
+        return -EINVAL;
+
+    // source may be cached under another fd, write everything back
+    if (BB_DATA->buf_policy != 0)
+        _flush_all();
+
+    // destination changes behind the buffer
+    if (BB_DATA->buf_dedup == 2)
+        _persist_forget(&statbuf);
+
+    while (copied < count) {
+        size = count - copied;
+
+        if (sparse) {
+            ret = _extent_size(src_fd, src_offset + copied, size, &hole);
+            if (ret < 0) {
+                // can't find the holes, copy block by block
+                sparse = 0;
+                offload = 0;
+                hole = 0;
+            } else {
+                size = ret;
+            }
+        }
+
+        if (hole) {
+            if (_zero_range(fd, offset + copied, size) < 0)
+                return -errno;
+            copied += size;
+            continue;
+        }
+
+        if (offload) {
+            ret = _copy_file_range(src_fd, src_offset + copied,
+                        fd, offset + copied, size);
+            if (ret > 0) {
+                buf_stats.copy_offloaded += ret;
+                copied += ret;
+                continue;
+            }
+            if (ret == 0) // source shrunk
+                break;
+            if (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+                errno != EOPNOTSUPP)
+                return -errno;
+
+            // backing fs can't, copy block by block
+            offload = 0;
+        }
+
+        if (size > CHUNK_SIZE)
+            size = CHUNK_SIZE;
+
+        if (size == CHUNK_SIZE &&
+            _hole_size(src_fd, src_offset + copied, size) == (ssize_t)size) {
+            memcpy(block, enc_zero_block(), size); // punched again
+        } else {
+            ret = _disk_read(src_fd, block, size, src_offset + copied);
+            if (ret < 0)
+                return -errno;
+            if (ret == 0)
+                break;
+            size = ret;
+        }
+
+        ret = _disk_write(fd, block, size, offset + copied);
+        if (ret < 0)
+            return -errno;
+        if (ret != (ssize_t)size)
+            return -EIO;
+
+        buf_stats.copy_blocks += size;
+        copied += size;
+    }
+
+    return copied;
+}
+
+void buf_log_stats
+(void)
+{
+    log_msg("\nBuffer stats: hits [%lu] misses [%lu]\n",
+        buf_stats.hits, buf_stats.misses);
+    log_msg("    blocks cached [%u] chunks in use [%u] dedup hits [%lu]\n",
+        evic_queue.occupied_nodes, chunk_pool.in_use, buf_stats.dedup_hits);
+    log_msg("    flush writes [%lu] flush clones [%lu]\n",
+        buf_stats.flush_writes, buf_stats.flush_clones);
+    log_msg("    holes read [%lu] holes punched [%lu]\n",
+        buf_stats.holes_read, buf_stats.holes_punched);
+    log_msg("    bytes copied: by backing fs [%llu] block by block [%llu]\n",
+        buf_stats.copy_offloaded, buf_stats.copy_blocks);
+
+    cmp_log_stats();
+}
@@ -1,12 +1,47 @@
 #pragma once
 
 #include <unistd.h>
+#include <sys/stat.h>
 
 void buf_get_policy(unsigned int *buf_policy);
 
+// 0: off, 1: dedup cached blocks, 2: 1 + dedup-on-flush (reflink)
+void buf_get_dedup(unsigned int *buf_dedup);
+
+// 4th line of ee516.conf, cache size in KB, as number of chunks
+void buf_get_cache_size(unsigned int *buf_chunks);
+
+// allocates the cache, before any other buf_ call
+int buf_init(unsigned int buf_chunks);
+
+// backing file was opened as 'fd', buf_close() closes it
+int buf_open(int fd);
+int buf_close(int fd);
+
 ssize_t buf_read(int fd, void *buf, size_t count, off_t offset, int flags);
 
 ssize_t buf_write(int fd, const void *buf, size_t count, off_t offset, int flags);
 
-int buf_close(int fd);
-int buf_flush(int fd);
\ No newline at end of file
+int buf_flush(int fd);
+
+// file is about to be cut, or gone and its inode number may be reused
+void buf_truncate(const struct stat *statbuf);
+void buf_forget(const struct stat *statbuf);
+
+// ftruncate() on backing file, returns -errno
+int buf_ftruncate(int fd, off_t size);
+
+// lstat() / fstat() on backing file, with size as seen through bbfs
+int buf_lstat(const char *fpath, struct stat *statbuf);
+int buf_fstat(int fd, struct stat *statbuf);
+
+// lseek() with SEEK_DATA / SEEK_HOLE on backing file
+off_t buf_seek(int fd, off_t offset, int whence);
+
+// fallocate() on backing file, keeps zeroed ranges reading as zeros
+int buf_fallocate(int fd, int mode, off_t offset, off_t len);
+
+// copies 'count' bytes between backing files without leaving the daemon
+ssize_t buf_copy_range(int src_fd, off_t src_offset, int fd, off_t offset, size_t count);
+
+void buf_log_stats(void);
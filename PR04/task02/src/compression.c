@@ -0,0 +1,974 @@
+#define _GNU_SOURCE // FALLOC_FL_*, SEEK_DATA & SEEK_HOLE
+
+#include "params.h"
+#include "compression.h"
+#include "encryption.h"
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#define CMP_BLOCK_SIZE 4096
+#define CMP_HEADER_SIZE 512 // payloads start after the header sector
+#define CMP_MAX_PAYLOAD (CMP_BLOCK_SIZE - CMP_BLOCK_SIZE / 8) // else stored raw
+#define CMP_SLOT_ALIGN 32 // a slightly bigger payload still fits its slot
+#define CMP_COMPACT_MIN (1024 * 1024) // garbage worth moving payloads for
+#define CMP_MAGIC "BBFSPAK"
+#define CMP_VERSION 1
+
+/* Packed backing file
+ *   [0, CMP_HEADER_SIZE)           header
+ *   [CMP_HEADER_SIZE, alloc_end)   payload slots & block index
+ * A block is rewritten in its slot if the payload fits, else it gets
+ * a new slot at alloc_end and the old one becomes garbage. Compaction
+ * moves payloads down over the garbage.
+ */
+struct cmp_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t size; // file size seen through bbfs
+    uint64_t alloc_end; // new slots are appended here
+    uint64_t index_offset;
+    uint64_t index_cap; // entries the on-disk index region holds
+    uint64_t nblocks; // entries in use, later blocks are holes
+    uint64_t garbage; // bytes of dropped slots
+};
+
+struct cmp_entry {
+    uint64_t offset; // of payload in backing file
+    uint32_t len; // 0: hole, CMP_BLOCK_SIZE: stored raw, else LZ4
+    uint32_t cap; // bytes reserved at 'offset'
+};
+
+/* Open backing file
+ * Shared by all fds referring to the same inode. Payloads are read
+ * and written through a private read-write fd, callers' fds may be
+ * write-only or read-only.
+ */
+struct cmp_file {
+    struct cmp_file *next;
+
+    dev_t dev;
+    ino_t ino;
+    unsigned int refs; // fds using it
+    int fd;
+    int packed; // 1: packed, 0: raw, -1: empty, packed on first write
+    int dirty; // header or index not on disk yet
+
+    struct cmp_header hdr;
+    struct cmp_entry *index;
+    uint64_t index_len; // entries allocated in memory
+};
+
+// only a few files are open at once
+static struct cmp_file *file_list = NULL;
+
+// tracked file of every fd
+static struct cmp_file **fd_table = NULL;
+static int fd_table_len = 0;
+
+// counters reported by cmp_log_stats()
+static struct {
+    unsigned long blocks_compressed;
+    unsigned long blocks_raw;
+    unsigned long blocks_zero;
+    unsigned long blocks_decompressed;
+    unsigned long long bytes_in; // of stored blocks
+    unsigned long long bytes_stored; // payload bytes written
+    unsigned long long compress_nsec; // cpu time
+    unsigned long long decompress_nsec;
+    unsigned long compactions;
+    unsigned long long bytes_reclaimed;
+} cmp_stats;
+
+#ifdef HAVE_LZ4
+// cpu time of calling thread
+static unsigned long long _cpu_nsec
+(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static struct cmp_file *_get_file
+(int fd)
+{
+    if (fd < 0 || fd >= fd_table_len)
+        return NULL;
+    return fd_table[fd];
+}
+
+static uint32_t _slot_size
+(uint32_t len)
+{
+    return (len + CMP_SLOT_ALIGN - 1) & ~(uint32_t)(CMP_SLOT_ALIGN - 1);
+}
+
+static int _is_header
+(const struct cmp_header *hdr)
+{
+    return memcmp(hdr->magic, CMP_MAGIC, sizeof(hdr->magic)) == 0;
+}
+
+// makes room for fd_table[fd]
+static int _fd_table_reserve
+(int fd)
+{
+    struct cmp_file **table;
+    int len;
+
+    if (fd < fd_table_len)
+        return 0;
+
+    len = fd_table_len ? fd_table_len : 64;
+    while (len <= fd)
+        len *= 2;
+
+    table = realloc(fd_table, len * sizeof(*table));
+    if (table == NULL)
+        return -1;
+    memset(table + fd_table_len, 0, (len - fd_table_len) * sizeof(*table));
+
+    fd_table = table;
+    fd_table_len = len;
+    return 0;
+}
+
+// makes room for 'nblocks' entries, new ones are holes
+static int _index_reserve
+(struct cmp_file *file, uint64_t nblocks)
+{
+    struct cmp_entry *index;
+    uint64_t len;
+
+    if (nblocks <= file->index_len)
+        return 0;
+
+    len = file->index_len ? file->index_len : 64;
+    while (len < nblocks)
+        len *= 2;
+
+    index = realloc(file->index, len * sizeof(*index));
+    if (index == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(index + file->index_len, 0, (len - file->index_len) * sizeof(*index));
+
+    file->index = index;
+    file->index_len = len;
+    return 0;
+}
+
+// block becomes a hole, its slot garbage
+static void _drop_block
+(struct cmp_file *file, uint64_t blk)
+{
+    if (blk >= file->hdr.nblocks)
+        return;
+
+    file->hdr.garbage += file->index[blk].cap;
+    memset(&file->index[blk], 0, sizeof(file->index[blk]));
+    file->dirty = 1;
+}
+
+// back to an empty file, packed again on first write
+static void _reset
+(struct cmp_file *file)
+{
+    memset(&file->hdr, 0, sizeof(file->hdr));
+    if (file->index != NULL)
+        memset(file->index, 0, file->index_len * sizeof(*file->index));
+    file->packed = -1;
+    file->dirty = 0;
+}
+
+// writes a fresh header, the file is packed from now on
+static int _format
+(struct cmp_file *file)
+{
+    memset(&file->hdr, 0, sizeof(file->hdr));
+    memcpy(file->hdr.magic, CMP_MAGIC, sizeof(file->hdr.magic));
+    file->hdr.version = CMP_VERSION;
+    file->hdr.block_size = CMP_BLOCK_SIZE;
+    file->hdr.alloc_end = CMP_HEADER_SIZE;
+
+    if (pwrite(file->fd, &file->hdr, sizeof(file->hdr), 0) != sizeof(file->hdr))
+        return -1;
+
+    file->packed = 1;
+    file->dirty = 1;
+    return 0;
+}
+
+// reads header & block index
+// returns 1 if the file isn't packed
+static int _load
+(struct cmp_file *file)
+{
+    size_t bytes;
+
+    if (pread(file->fd, &file->hdr, sizeof(file->hdr), 0) != sizeof(file->hdr) ||
+        !_is_header(&file->hdr))
+        return 1;
+
+    if (file->hdr.version != CMP_VERSION || file->hdr.block_size != CMP_BLOCK_SIZE ||
+        file->hdr.nblocks > file->hdr.index_cap) {
+        log_msg("ERROR : unknown packed file format\n");
+        return -1;
+    }
+
+    if (_index_reserve(file, file->hdr.nblocks) < 0)
+        return -1;
+
+    bytes = file->hdr.nblocks * sizeof(struct cmp_entry);
+    if (bytes > 0 && pread(file->fd, file->index, bytes,
+                        file->hdr.index_offset) != (ssize_t)bytes)
+        return -1;
+
+    return 0;
+}
+
+// slots of live blocks, by offset in backing file
+struct cmp_slot {
+    uint64_t offset;
+    uint64_t blk;
+};
+
+static int _slot_cmp
+(const void *a, const void *b)
+{
+    const struct cmp_slot *x = a, *y = b;
+
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return 0;
+}
+
+// moves all payloads down over the garbage, in offset order
+// a payload never lands on one that wasn't moved yet
+static int _compact
+(struct cmp_file *file)
+{
+    unsigned char payload[CMP_BLOCK_SIZE];
+    struct cmp_entry *entry;
+    struct cmp_slot *slots;
+    uint64_t blk, n = 0, i, pos = CMP_HEADER_SIZE;
+    int ret = 0;
+
+    slots = malloc(file->hdr.nblocks * sizeof(*slots) + 1);
+    if (slots == NULL)
+        return -1;
+
+    for (blk = 0; blk < file->hdr.nblocks; blk++) {
+        if (file->index[blk].len == 0)
+            continue;
+        slots[n].offset = file->index[blk].offset;
+        slots[n].blk = blk;
+        n++;
+    }
+    qsort(slots, n, sizeof(*slots), _slot_cmp);
+
+    for (i = 0; i < n; i++) {
+        entry = &file->index[slots[i].blk];
+        if (entry->offset != pos) {
+            if (pread(file->fd, payload, entry->len, entry->offset) != entry->len ||
+                pwrite(file->fd, payload, entry->len, pos) != entry->len) {
+                ret = -1;
+                break;
+            }
+            entry->offset = pos;
+        }
+        entry->cap = _slot_size(entry->len);
+        pos += entry->cap;
+    }
+    free(slots);
+
+    // slots after a failed move stay where they are
+    if (ret < 0)
+        return ret;
+
+    // old index region is gone as well, a new one is appended
+    cmp_stats.compactions += 1;
+    cmp_stats.bytes_reclaimed += file->hdr.alloc_end - pos;
+    file->hdr.alloc_end = pos;
+    file->hdr.index_offset = 0;
+    file->hdr.index_cap = 0;
+    file->hdr.garbage = 0;
+    file->dirty = 1;
+    return 0;
+}
+
+// writes back block index & header
+static int _sync
+(struct cmp_file *file)
+{
+    size_t bytes;
+    int compacted = 0;
+
+    if (file->packed != 1 || !file->dirty)
+        return 0;
+
+    if (file->hdr.garbage >= CMP_COMPACT_MIN &&
+        file->hdr.garbage > (file->hdr.alloc_end - CMP_HEADER_SIZE) / 2)
+        compacted = _compact(file) == 0;
+
+    // index outgrew its region, append a bigger one
+    if (file->hdr.nblocks > file->hdr.index_cap) {
+        file->hdr.garbage += file->hdr.index_cap * sizeof(struct cmp_entry);
+        file->hdr.index_cap = file->hdr.nblocks < 32 ? 64 : file->hdr.nblocks * 2;
+        file->hdr.index_offset = file->hdr.alloc_end;
+        file->hdr.alloc_end += file->hdr.index_cap * sizeof(struct cmp_entry);
+    }
+
+    bytes = file->hdr.nblocks * sizeof(struct cmp_entry);
+    if (bytes > 0 && pwrite(file->fd, file->index, bytes,
+                        file->hdr.index_offset) != (ssize_t)bytes)
+        return -1;
+    if (pwrite(file->fd, &file->hdr, sizeof(file->hdr), 0) != sizeof(file->hdr))
+        return -1;
+
+    // drop the tail that compaction freed
+    if (compacted && ftruncate(file->fd, file->hdr.alloc_end) < 0)
+        return -1;
+
+    file->dirty = 0;
+    return 0;
+}
+
+// 4KB encrypted 'data' into 'payload', returns payload length
+// compression works on the plain data, its output is encrypted again
+static uint32_t _compress
+(const unsigned char *data, unsigned char *payload)
+{
+#ifdef HAVE_LZ4
+    unsigned char plain[CMP_BLOCK_SIZE];
+    char packed[CMP_MAX_PAYLOAD];
+    unsigned char *enc_buf = NULL;
+    unsigned long long start = _cpu_nsec();
+    int len;
+
+    memcpy(plain, data, CMP_BLOCK_SIZE);
+    enc_decrypt_data(plain, CMP_BLOCK_SIZE);
+
+    len = LZ4_compress_default((const char *)plain, packed, CMP_BLOCK_SIZE,
+                CMP_MAX_PAYLOAD); // 0 if it doesn't fit
+    if (len > 0 && enc_encrypt_data((unsigned char *)packed, len, &enc_buf) == 0) {
+        memcpy(payload, enc_buf, len);
+        free(enc_buf);
+        cmp_stats.compress_nsec += _cpu_nsec() - start;
+        cmp_stats.blocks_compressed += 1;
+        return len;
+    }
+    cmp_stats.compress_nsec += _cpu_nsec() - start;
+#endif
+
+    // incompressible, stored raw
+    memcpy(payload, data, CMP_BLOCK_SIZE);
+    cmp_stats.blocks_raw += 1;
+    return CMP_BLOCK_SIZE;
+}
+
+// 'len' bytes of LZ4 'payload' back into 4KB encrypted 'data'
+static int _decompress
+(unsigned char *payload, uint32_t len, unsigned char *data)
+{
+#ifdef HAVE_LZ4
+    unsigned char plain[CMP_BLOCK_SIZE];
+    unsigned char *enc_buf = NULL;
+    unsigned long long start = _cpu_nsec();
+    int ret;
+
+    enc_decrypt_data(payload, len);
+    ret = LZ4_decompress_safe((const char *)payload, (char *)plain, len,
+                CMP_BLOCK_SIZE);
+    if (ret == CMP_BLOCK_SIZE)
+        ret = enc_encrypt_data(plain, CMP_BLOCK_SIZE, &enc_buf);
+    else
+        ret = -1;
+    cmp_stats.decompress_nsec += _cpu_nsec() - start;
+
+    if (ret < 0) {
+        log_msg("ERROR : corrupt compressed block\n");
+        errno = EIO;
+        return -1;
+    }
+
+    memcpy(data, enc_buf, CMP_BLOCK_SIZE);
+    free(enc_buf);
+    cmp_stats.blocks_decompressed += 1;
+    return 0;
+#else
+    errno = EIO;
+    return -1;
+#endif
+}
+
+// reads block 'blk' as a raw backing file would hold it: encrypted,
+// holes as encrypted zeros
+static int _read_block
+(struct cmp_file *file, uint64_t blk, unsigned char *data)
+{
+    unsigned char payload[CMP_BLOCK_SIZE];
+    struct cmp_entry *entry;
+    ssize_t ret;
+
+    if (blk >= file->hdr.nblocks || file->index[blk].len == 0) {
+        memcpy(data, enc_zero_block(), CMP_BLOCK_SIZE);
+        return 0;
+    }
+
+    // raw blocks straight into 'data'
+    entry = &file->index[blk];
+    ret = pread(file->fd, entry->len == CMP_BLOCK_SIZE ? data : payload,
+                entry->len, entry->offset);
+    if (ret != entry->len) {
+        if (ret >= 0) // slot cut short behind our back
+            errno = EIO;
+        return -1;
+    }
+
+    if (entry->len == CMP_BLOCK_SIZE)
+        return 0;
+    return _decompress(payload, entry->len, data);
+}
+
+// stores 4KB encrypted 'data' as block 'blk'
+static int _store_block
+(struct cmp_file *file, uint64_t blk, const unsigned char *data)
+{
+    unsigned char payload[CMP_BLOCK_SIZE];
+    struct cmp_entry *entry;
+    uint32_t len;
+    ssize_t ret;
+
+    // zero blocks are holes, as punched ones of raw files
+    if (memcmp(data, enc_zero_block(), CMP_BLOCK_SIZE) == 0) {
+        _drop_block(file, blk);
+        cmp_stats.blocks_zero += 1;
+        return 0;
+    }
+
+    if (_index_reserve(file, blk + 1) < 0)
+        return -1;
+
+    len = _compress(data, payload);
+
+    // doesn't fit its slot, take a new one
+    entry = &file->index[blk];
+    if (entry->cap < len) {
+        file->hdr.garbage += entry->cap;
+        entry->offset = file->hdr.alloc_end;
+        entry->cap = _slot_size(len);
+        file->hdr.alloc_end += entry->cap;
+    }
+    entry->len = len;
+
+    if (blk >= file->hdr.nblocks)
+        file->hdr.nblocks = blk + 1;
+    file->dirty = 1;
+
+    ret = pwrite(file->fd, payload, len, entry->offset);
+    if (ret != len) {
+        entry->len = 0; // unknown what the slot holds now
+        if (ret >= 0)
+            errno = ENOSPC;
+        return -1;
+    }
+
+    cmp_stats.bytes_in += CMP_BLOCK_SIZE;
+    cmp_stats.bytes_stored += len;
+    return 0;
+}
+
+// fills [start, end) with encrypted zeros, whole blocks become holes
+static int _zero_range
+(struct cmp_file *file, uint64_t start, uint64_t end)
+{
+    unsigned char data[CMP_BLOCK_SIZE];
+    uint64_t pos, next, blk;
+
+    // blocks past the index are holes already
+    if (end > file->hdr.nblocks * CMP_BLOCK_SIZE)
+        end = file->hdr.nblocks * CMP_BLOCK_SIZE;
+
+    for (pos = start; pos < end; pos = next) {
+        blk = pos / CMP_BLOCK_SIZE;
+        next = (blk + 1) * CMP_BLOCK_SIZE;
+        if (next > end)
+            next = end;
+
+        if (file->index[blk].len == 0)
+            continue;
+
+        if (next - pos == CMP_BLOCK_SIZE) {
+            _drop_block(file, blk);
+            continue;
+        }
+
+        if (_read_block(file, blk, data) < 0)
+            return -1;
+        memcpy(data + pos % CMP_BLOCK_SIZE, enc_zero_block(), next - pos);
+        if (_store_block(file, blk, data) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+void cmp_get_mode
+(unsigned int *cmp_mode)
+{
+    FILE *fp_conf;
+    unsigned int _cmp_mode = 0;
+
+    //sanity check
+    if (cmp_mode == NULL)
+        return;
+
+    // open file
+    fp_conf = fopen("ee516.conf", "r");
+
+    if (fp_conf != NULL) {
+        int matched;
+
+        // read compression mode (5th line)
+        matched = fscanf(fp_conf, "%*[^\n]\n%*[^\n]\n%*[^\n]\n%*[^\n]\n%u", &_cmp_mode);
+
+        // ensure read correctly
+        if (matched != 1 || _cmp_mode > 1)
+            _cmp_mode = 0;
+
+        // close file
+        fclose(fp_conf);
+    }
+
+#ifndef HAVE_LZ4
+    if (_cmp_mode != 0)
+        fprintf(stderr, "bbfs built without LZ4, compression disabled\n");
+    _cmp_mode = 0;
+#endif
+
+    *cmp_mode = _cmp_mode;
+}
+
+int cmp_open
+(int fd)
+{
+    struct cmp_file *file;
+    struct stat statbuf;
+    char proc[64];
+    int ret;
+
+    if (BB_DATA->cmp_mode == 0)
+        return 0;
+
+    if (fstat(fd, &statbuf) < 0)
+        return -errno;
+    if (!S_ISREG(statbuf.st_mode))
+        return 0;
+    if (_fd_table_reserve(fd) < 0)
+        return -ENOMEM;
+
+    for (file = file_list; file != NULL; file = file->next) {
+        if (file->dev == statbuf.st_dev && file->ino == statbuf.st_ino)
+            break;
+    }
+
+    if (file == NULL) {
+        file = calloc(1, sizeof(*file));
+        if (file == NULL)
+            return -ENOMEM;
+        file->dev = statbuf.st_dev;
+        file->ino = statbuf.st_ino;
+
+        // private fd, 'fd' may not allow reading or writing
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+        file->fd = open(proc, O_RDWR);
+        if (file->fd < 0)
+            file->fd = dup(fd);
+        if (file->fd < 0) {
+            ret = -errno;
+            free(file);
+            return ret;
+        }
+
+        if (statbuf.st_size == 0) {
+            file->packed = -1;
+        } else {
+            ret = _load(file);
+            if (ret < 0) {
+                close(file->fd);
+                free(file->index);
+                free(file);
+                return -EIO;
+            }
+            file->packed = ret == 0;
+            if (!file->packed)
+                memset(&file->hdr, 0, sizeof(file->hdr));
+        }
+
+        file->next = file_list;
+        file_list = file;
+    } else if (file->packed != -1 && statbuf.st_size == 0) {
+        // creat() cut it behind our back
+        _reset(file);
+    }
+
+    file->refs += 1;
+    fd_table[fd] = file;
+    return 0;
+}
+
+int cmp_flush
+(int fd)
+{
+    struct cmp_file *file = _get_file(fd);
+
+    if (file == NULL)
+        return 0;
+
+    return _sync(file);
+}
+
+void cmp_close
+(int fd)
+{
+    struct cmp_file *file = _get_file(fd);
+    struct cmp_file **link;
+
+    if (file == NULL)
+        return;
+    fd_table[fd] = NULL;
+
+    if (_sync(file) < 0)
+        log_msg("ERROR : block index not written back\n");
+
+    file->refs -= 1;
+    if (file->refs > 0)
+        return;
+
+    for (link = &file_list; *link != file; link = &(*link)->next)
+        ;
+    *link = file->next;
+
+    close(file->fd);
+    free(file->index);
+    free(file);
+}
+
+int cmp_is_packed
+(int fd)
+{
+    struct cmp_file *file = _get_file(fd);
+
+    return file != NULL && file->packed != 0;
+}
+
+int cmp_fstat
+(int fd, struct stat *statbuf)
+{
+    struct cmp_file *file = _get_file(fd);
+
+    if (fstat(fd, statbuf) < 0)
+        return -1;
+
+    if (file != NULL && file->packed != 0)
+        statbuf->st_size = file->hdr.size;
+    return 0;
+}
+
+// files that aren't open are only packed if their header says so
+int cmp_lstat
+(const char *fpath, struct stat *statbuf)
+{
+    struct cmp_file *file;
+    struct cmp_header hdr;
+    int fd;
+
+    if (lstat(fpath, statbuf) < 0)
+        return -1;
+
+    if (BB_DATA->cmp_mode == 0 || !S_ISREG(statbuf->st_mode))
+        return 0;
+
+    for (file = file_list; file != NULL; file = file->next) {
+        if (file->dev == statbuf->st_dev && file->ino == statbuf->st_ino) {
+            if (file->packed != 0)
+                statbuf->st_size = file->hdr.size;
+            return 0;
+        }
+    }
+
+    if (statbuf->st_size < (off_t)sizeof(hdr))
+        return 0;
+
+    fd = open(fpath, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && _is_header(&hdr))
+        statbuf->st_size = hdr.size;
+    close(fd);
+
+    return 0;
+}
+
+ssize_t cmp_read
+(int fd, void *buf, size_t count, off_t offset)
+{
+    struct cmp_file *file = _get_file(fd);
+    unsigned char data[CMP_BLOCK_SIZE];
+    unsigned char *ptr = buf;
+    uint64_t pos, blk;
+    size_t done, n;
+
+    if (file == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    // nothing at end of file
+    if ((uint64_t)offset >= file->hdr.size)
+        return 0;
+    if (count > file->hdr.size - offset)
+        count = file->hdr.size - offset;
+
+    for (done = 0; done < count; done += n) {
+        pos = offset + done;
+        blk = pos / CMP_BLOCK_SIZE;
+        n = CMP_BLOCK_SIZE - pos % CMP_BLOCK_SIZE;
+        if (n > count - done)
+            n = count - done;
+
+        if (n == CMP_BLOCK_SIZE) {
+            if (_read_block(file, blk, ptr + done) < 0)
+                return -1;
+        } else {
+            if (_read_block(file, blk, data) < 0)
+                return -1;
+            memcpy(ptr + done, data + pos % CMP_BLOCK_SIZE, n);
+        }
+    }
+
+    return count;
+}
+
+ssize_t cmp_write
+(int fd, const void *buf, size_t count, off_t offset)
+{
+    struct cmp_file *file = _get_file(fd);
+    unsigned char data[CMP_BLOCK_SIZE];
+    const unsigned char *ptr = buf;
+    uint64_t pos, blk;
+    size_t done, n;
+
+    if (file == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (file->packed < 0 && _format(file) < 0)
+        return -1;
+
+    for (done = 0; done < count; done += n) {
+        pos = offset + done;
+        blk = pos / CMP_BLOCK_SIZE;
+        n = CMP_BLOCK_SIZE - pos % CMP_BLOCK_SIZE;
+        if (n > count - done)
+            n = count - done;
+
+        // part of a block, merge with what is stored
+        if (n == CMP_BLOCK_SIZE) {
+            if (_store_block(file, blk, ptr + done) < 0)
+                break;
+        } else {
+            if (_read_block(file, blk, data) < 0)
+                break;
+            memcpy(data + pos % CMP_BLOCK_SIZE, ptr + done, n);
+            if (_store_block(file, blk, data) < 0)
+                break;
+        }
+    }
+
+    if (offset + done > file->hdr.size) {
+        file->hdr.size = offset + done;
+        file->dirty = 1;
+    }
+
+    if (done == 0 && count > 0)
+        return -1;
+    return done;
+}
+
+// count if [offset, offset + count) is all hole, less if end of file
+// cuts it short, 0 at or beyond end of file, -1 if it holds data
+ssize_t cmp_hole_size
+(int fd, off_t offset, size_t count)
+{
+    struct cmp_file *file = _get_file(fd);
+    uint64_t end, blk;
+
+    if (file == NULL)
+        return -1;
+
+    if ((uint64_t)offset >= file->hdr.size)
+        return 0;
+    end = offset + count;
+    if (end > file->hdr.size)
+        end = file->hdr.size;
+
+    for (blk = offset / CMP_BLOCK_SIZE; blk * CMP_BLOCK_SIZE < end; blk++) {
+        if (blk < file->hdr.nblocks && file->index[blk].len != 0)
+            return -1;
+    }
+
+    return end - offset;
+}
+
+// SEEK_DATA / SEEK_HOLE, end of file is a hole
+off_t cmp_seek
+(int fd, off_t offset, int whence)
+{
+    struct cmp_file *file = _get_file(fd);
+    uint64_t blk, pos;
+
+    if (file == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (offset < 0 || (uint64_t)offset >= file->hdr.size) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    for (blk = offset / CMP_BLOCK_SIZE; blk * CMP_BLOCK_SIZE < file->hdr.size; blk++) {
+        int data = blk < file->hdr.nblocks && file->index[blk].len != 0;
+
+        if (data == (whence == SEEK_DATA)) {
+            pos = blk * CMP_BLOCK_SIZE;
+            return pos > (uint64_t)offset ? (off_t)pos : offset;
+        }
+    }
+
+    if (whence == SEEK_DATA) {
+        errno = ENXIO;
+        return -1;
+    }
+    return file->hdr.size;
+}
+
+/*
+ * Only the block index changes. Slots are taken when blocks are
+ * written, so preallocation reserves nothing on the backing fs.
+ * returns -errno
+*/
+int cmp_fallocate
+(int fd, int mode, off_t offset, off_t len)
+{
+    struct cmp_file *file = _get_file(fd);
+    uint64_t end = offset + len;
+
+    if (file == NULL)
+        return -EBADF;
+
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+        return -EOPNOTSUPP;
+
+    if (file->packed < 0) {
+        if ((mode & FALLOC_FL_KEEP_SIZE) || end == 0)
+            return 0;
+        if (_format(file) < 0)
+            return -errno;
+    }
+
+    // past end of file reads as zeros already
+    if (mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) {
+        if (_zero_range(file, offset, end < file->hdr.size ? end : file->hdr.size) < 0)
+            return -errno;
+    }
+
+    if (!(mode & FALLOC_FL_KEEP_SIZE) && end > file->hdr.size) {
+        file->hdr.size = end;
+        file->dirty = 1;
+    }
+
+    return 0;
+}
+
+int cmp_truncate
+(int fd, off_t size)
+{
+    struct cmp_file *file = _get_file(fd);
+    uint64_t keep, blk;
+
+    if (file == NULL)
+        return ftruncate(fd, size);
+
+    // cut to nothing, packed again on next write
+    if (size == 0) {
+        if (ftruncate(file->fd, 0) < 0)
+            return -1;
+        _reset(file);
+        return 0;
+    }
+
+    if (file->packed == 0)
+        return ftruncate(file->fd, size);
+    if (file->packed < 0 && _format(file) < 0)
+        return -1;
+
+    if ((uint64_t)size < file->hdr.size) {
+        keep = (size + CMP_BLOCK_SIZE - 1) / CMP_BLOCK_SIZE;
+        for (blk = keep; blk < file->hdr.nblocks; blk++)
+            _drop_block(file, blk);
+        if (file->hdr.nblocks > keep)
+            file->hdr.nblocks = keep;
+
+        // tail of last block has to read as zeros if the file grows again
+        if (_zero_range(file, size, keep * CMP_BLOCK_SIZE) < 0)
+            return -1;
+    }
+
+    file->hdr.size = size;
+    file->dirty = 1;
+    return 0;
+}
+
+void cmp_log_stats
+(void)
+{
+    double ratio = 1.0;
+    unsigned long blocks;
+
+    if (BB_DATA->cmp_mode == 0)
+        return;
+
+    if (cmp_stats.bytes_stored > 0)
+        ratio = (double)cmp_stats.bytes_in / cmp_stats.bytes_stored;
+    blocks = cmp_stats.blocks_compressed + cmp_stats.blocks_raw;
+
+    log_msg("\nCompression stats: compressed [%lu] raw [%lu] zero [%lu] blocks\n",
+        cmp_stats.blocks_compressed, cmp_stats.blocks_raw, cmp_stats.blocks_zero);
+    log_msg("    bytes in [%llu] stored [%llu] ratio [%.2f]\n",
+        cmp_stats.bytes_in, cmp_stats.bytes_stored, ratio);
+    log_msg("    cpu usec: compress [%llu] (%llu nsec/block) decompress [%llu] (%lu blocks)\n",
+        cmp_stats.compress_nsec / 1000,
+        blocks ? cmp_stats.compress_nsec / blocks : 0ULL,
+        cmp_stats.decompress_nsec / 1000, cmp_stats.blocks_decompressed);
+    log_msg("    compactions [%lu] bytes reclaimed [%llu]\n",
+        cmp_stats.compactions, cmp_stats.bytes_reclaimed);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Per-block compression
+ * Blocks are LZ4 compressed before encryption and their payloads are
+ * packed back to back in the backing file, after a small header. A
+ * per-file block index maps every 4KB block to the (offset, len) of
+ * its payload, so a random read only decompresses the blocks it
+ * touches. Incompressible blocks are stored raw, zero blocks not at
+ * all (holes). Header and index are written back on flush and close.
+ *
+ * Offsets and sizes taken and returned here are those of the file
+ * seen through bbfs, never of the backing file. Files that existed
+ * before compression was turned on stay raw, empty files are packed
+ * on their first write. Like the keys, the mode must not change
+ * between mounts of a tree.
+ */
+
+// 5th line of ee516.conf, 0: off, 1: LZ4
+void cmp_get_mode(unsigned int *cmp_mode);
+
+// starts tracking backing file opened as 'fd', loads its block index
+int cmp_open(int fd);
+
+// writes back block index of 'fd'
+int cmp_flush(int fd);
+
+// writes back & stops tracking 'fd', before it is closed
+void cmp_close(int fd);
+
+// 1 if 'fd' is read & written through a block index
+int cmp_is_packed(int fd);
+
+// fstat() / lstat() with size of file seen through bbfs
+int cmp_fstat(int fd, struct stat *statbuf);
+int cmp_lstat(const char *fpath, struct stat *statbuf);
+
+// pread() / pwrite() of a packed file, holes read as encrypted zeros
+ssize_t cmp_read(int fd, void *buf, size_t count, off_t offset);
+ssize_t cmp_write(int fd, const void *buf, size_t count, off_t offset);
+
+// same answers as on a raw backing file, from the block index
+ssize_t cmp_hole_size(int fd, off_t offset, size_t count);
+off_t cmp_seek(int fd, off_t offset, int whence);
+int cmp_fallocate(int fd, int mode, off_t offset, off_t len);
+
+// ftruncate() of any backing file, packed or not
+int cmp_truncate(int fd, off_t size);
+
+void cmp_log_stats(void);
@@ -109,4 +109,35 @@ int enc_encrypt_data
 #endif
 
     return 0;
+}
+
+int enc_is_enabled
+(void)
+{
+    return BB_DATA->key_add != 0 || BB_DATA->key_shift != 0;
+}
+
+static unsigned char zero_block[4096];
+
+int enc_init_zero_block
+(void)
+{
+    unsigned char *enc_buf = NULL;
+    int ret;
+
+    /* keys don't change while mounted, encrypt once */
+    memset(zero_block, 0, sizeof(zero_block));
+    ret = enc_encrypt_data(zero_block, sizeof(zero_block), &enc_buf);
+    if (ret < 0)
+        return ret;
+
+    memcpy(zero_block, enc_buf, sizeof(zero_block));
+    free(enc_buf);
+    return 0;
+}
+
+const unsigned char *enc_zero_block
+(void)
+{
+    return zero_block;
 }
\ No newline at end of file
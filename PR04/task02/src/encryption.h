@@ -9,4 +9,17 @@ int enc_encrypt_data
 (const unsigned char *buf, size_t size, unsigned char **enc_buf);
 
 void enc_get_keys
-(unsigned int *add_key, unsigned int *shift_key);
\ No newline at end of file
+(unsigned int *add_key, unsigned int *shift_key);
+
+// 0 if keys are zero, i.e. data is stored as is
+int enc_is_enabled
+(void);
+
+// builds the zero block below, once before any request is served
+// (requests run on several threads, the block is never written again)
+int enc_init_zero_block
+(void);
+
+// 4KB block that decrypts to zeros, shared by all holes of backing files
+const unsigned char *enc_zero_block
+(void);
@@ -26,9 +26,13 @@
 struct bb_state {
     FILE *logfile;
     char *rootdir;
+    char *mountdir;
     unsigned int key_add;
     unsigned int key_shift;
     unsigned int buf_policy;
+    unsigned int buf_dedup;
+    unsigned int buf_chunks; // cache size, 4KB chunks
+    unsigned int cmp_mode; // 0: off, 1: LZ4 packed blocks
 };
 #define BB_DATA ((struct bb_state *) fuse_get_context()->private_data)
 
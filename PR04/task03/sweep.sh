@@ -0,0 +1,186 @@
+#!/bin/bash
+
+# Sweeps bbfs over a configuration matrix
+#
+# For every point of cipher x cache size x eviction policy x request size,
+# bbfs is mounted on a scratch directory with its own ee516.conf, fsbench
+# runs RUNS times against the mount, and bbfs is unmounted again.
+# All runs end up in one CSV, summarized per point & phase by median,
+# mean and 95% confidence interval of the mean.
+#
+# The matrix is taken from the environment:
+#	CIPHERS		"<add key>:<shift key> ...", 0:0 disables encryption
+#			(default "0:0 1:2")
+#	CACHE_KB	buffer cache sizes in KB (default "1024 5120")
+#	POLICIES	0: no buffer, 1: random, 2: LRU eviction (default "0 1 2")
+#	REQ_SIZES	fsbench request sizes in bytes (default "4096 65536")
+#	RUNS		fsbench runs per point (default 5)
+#	FSBENCH_OPTS	extra fsbench options (default "-n 4 -s 4M")
+#	COMPRESSION	block compression of every point, 0: off, 1: LZ4
+#			(default 0)
+#	BBFS, FSBENCH	binaries (default: built in this repository)
+#
+# Usage: sweep.sh [output directory]
+
+CIPHERS=${CIPHERS:-"0:0 1:2"}
+CACHE_KB=${CACHE_KB:-"1024 5120"}
+POLICIES=${POLICIES:-"0 1 2"}
+REQ_SIZES=${REQ_SIZES:-"4096 65536"}
+RUNS=${RUNS:-5}
+FSBENCH_OPTS=${FSBENCH_OPTS:-"-n 4 -s 4M"}
+COMPRESSION=${COMPRESSION:-0}
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BBFS=${BBFS:-"$HERE/../task02/src/bbfs"}
+FSBENCH=${FSBENCH:-"$HERE/../../PR01/fsbench"}
+OUTDIR=${1:-"sweep-$(date +%Y%m%d-%H%M%S)"}
+
+SCRATCH=""
+MOUNTED=""
+
+# Function: cleanup
+# Purpose: To unmount bbfs & remove scratch directories, also on errors
+cleanup() {
+	if [ -n "$MOUNTED" ]; then
+		fusermount -u "$MOUNTED" 2> /dev/null || umount "$MOUNTED"
+		MOUNTED=""
+	fi
+	if [ -n "$SCRATCH" ]; then
+		rm -rf "$SCRATCH"
+		SCRATCH=""
+	fi
+}
+
+# Function: die
+# Purpose: To print an error & exit
+# Arguments
+#	($1): Error message
+die() {
+	echo "sweep: $1" >&2
+	cleanup
+	exit 1
+}
+
+trap cleanup EXIT
+trap 'die "interrupted"' INT TERM
+
+# Function: run_point
+# Purpose: To benchmark bbfs with one configuration
+# Arguments
+#	($1): Cipher, <add key>:<shift key>
+#	($2): Cache size in KB
+#	($3): Eviction policy
+#	($4): Request size
+#	($5): Result CSV of fsbench
+run_point() {
+	SCRATCH=$(mktemp -d) || die "mktemp failed"
+	mkdir "$SCRATCH/root" "$SCRATCH/mnt" "$SCRATCH/conf"
+
+	# ee516.conf: keys, buffer policy, dedup, cache size, compression
+	# bbfs reads it (and writes bbfs.log) in its working directory
+	printf "%s %s\n%s\n0\n%s\n%s\n" "${1%%:*}" "${1##*:}" "$3" "$2" \
+		"$COMPRESSION" > "$SCRATCH/conf/ee516.conf"
+
+	(cd "$SCRATCH/conf" && "$BBFS" "$SCRATCH/root" "$SCRATCH/mnt") ||
+		die "cannot mount bbfs"
+	MOUNTED="$SCRATCH/mnt"
+
+	# fuse_main() returns to the shell once the mount is up
+	grep -q " $SCRATCH/mnt " /proc/mounts || die "bbfs is not mounted"
+
+	"$FSBENCH" -R "$RUNS" -o "$5" $FSBENCH_OPTS "$SCRATCH/mnt" "$4" \
+		> "$5.log" || die "fsbench failed, see $5.log"
+
+	cp "$SCRATCH/conf/bbfs.log" "$5.bbfs.log" 2> /dev/null
+	cleanup
+}
+
+[ -x "$BBFS" ] || die "bbfs not found at $BBFS (build task02 or set BBFS)"
+[ -x "$FSBENCH" ] || die "fsbench not found at $FSBENCH (make -C PR01 or set FSBENCH)"
+mkdir -p "$OUTDIR" || die "cannot create $OUTDIR"
+
+RESULTS="$OUTDIR/results.csv"
+echo "cipher,cache_kb,policy,req_size,run,index,phase,usec,ops,bytes,iops,mbps,p99_us" \
+	> "$RESULTS"
+
+for CIPHER in $CIPHERS
+do
+	for CACHE in $CACHE_KB
+	do
+		for POLICY in $POLICIES
+		do
+			for REQ in $REQ_SIZES
+			do
+				# cache size does not matter without buffer
+				if [ "$POLICY" = 0 ] && [ "$CACHE" != "${CACHE_KB%% *}" ]; then
+					continue
+				fi
+
+				POINT="$OUTDIR/enc_${CIPHER/:/_}_cache_${CACHE}_buff_${POLICY}_req_${REQ}"
+				echo "cipher $CIPHER, cache ${CACHE}KB, policy $POLICY, request $REQ .."
+				run_point "$CIPHER" "$CACHE" "$POLICY" "$REQ" "$POINT.csv"
+
+				# run,index,phase,usec,ops,bytes,iops,mbps,mean,p50,p90,p99,...
+				awk -F, -v point="$CIPHER,$CACHE,$POLICY,$REQ" \
+					'/^[0-9]/ { print point "," $1 "," $2 "," $3 "," $4 "," \
+						$5 "," $6 "," $7 "," $8 "," $12 }' \
+					"$POINT.csv" >> "$RESULTS"
+			done
+		done
+	done
+done
+
+# median, mean & 95% CI of throughput (MB/s, IOPS for phases moving
+# no bytes) and median p99 per point & phase
+awk -F, '
+	# two sided 95% quantile of Student t, df 1..30
+	BEGIN {
+		split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 " \
+			"2.228 2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 " \
+			"2.093 2.086 2.080 2.074 2.069 2.064 2.060 2.056 2.052 " \
+			"2.048 2.045 2.042", t95, " ")
+	}
+
+	function median(v, n,    i, j, tmp) {
+		for (i = 2; i <= n; i++)
+			for (j = i; j > 1 && v[j - 1] > v[j]; j--) {
+				tmp = v[j]; v[j] = v[j - 1]; v[j - 1] = tmp
+			}
+		return n % 2 ? v[(n + 1) / 2] : (v[n / 2] + v[n / 2 + 1]) / 2
+	}
+
+	NR > 1 {
+		key = $1 "," $2 "," $3 "," $4 "," $6 "," $7
+		if (!(key in n))
+			order[++nr_keys] = key
+		n[key]++
+		tput[key, n[key]] = $10 > 0 ? $12 : $11
+		p99[key, n[key]] = $13
+		unit[key] = $10 > 0 ? "MB/s" : "IOPS"
+	}
+
+	END {
+		printf "%-7s %8s %6s %8s %-10s %4s %12s %12s %25s %10s\n", "cipher", \
+			"cache_kb", "policy", "req", "phase", "unit", "median", "mean", \
+			"95% CI", "p99 usec"
+		for (k = 1; k <= nr_keys; k++) {
+			key = order[k]
+			cnt = n[key]
+			sum = 0; sq = 0
+			for (i = 1; i <= cnt; i++) {
+				v[i] = tput[key, i]; sum += v[i]; sq += v[i] * v[i]
+				w[i] = p99[key, i]
+			}
+			mean = sum / cnt
+			sd = cnt > 1 ? sqrt((sq - sum * sum / cnt) / (cnt - 1)) : 0
+			half = cnt > 1 ? (cnt - 1 <= 30 ? t95[cnt - 1] : 1.96) * sd / sqrt(cnt) : 0
+
+			split(key, f, ",")
+			printf "%-7s %8s %6s %8s %-10s %4s %12.2f %12.2f %12.2f - %10.2f %10.1f\n", \
+				f[1], f[2], f[3], f[4], f[6], unit[key], median(v, cnt), \
+				mean, mean - half, mean + half, median(w, cnt)
+		}
+	}' "$RESULTS" | tee "$OUTDIR/report.txt"
+
+echo "results: $RESULTS, report: $OUTDIR/report.txt"
+exit 0
@@ -14,14 +14,30 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <malloc.h>
+#include <time.h>
 
 #define NUMFILES	1
 #define FILESIZE	10 * 1024 *1024  // 1MB
 
+#define NR_REQUESTS	(FILESIZE / 512) // enough for smallest request size
+
 char *dirname;
 int req_size;
 ssize_t act_size;
 
+/* latency of every request in current phase (nsec) */
+long lat[NR_REQUESTS];
+int nr_lat;
+
+/* per phase latency summary (usec) */
+struct lat_result {
+	const char *name;
+	int requests;
+	double p50, p90, p99, p999, max;
+};
+struct lat_result lat_results[4];
+int nr_results;
+
 /* Print usage including arguments */
 void usage(char *prog)
 {
@@ -32,13 +48,58 @@ void usage(char *prog)
 
 /* return current time using a usec unit */
 long gettimeusec(){
-	struct timeval time;
+	struct timespec time;
 	long usec; 
-	gettimeofday(&time, NULL);
-	usec = (time.tv_sec * 1000000 + time.tv_usec);
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	usec = (time.tv_sec * 1000000 + time.tv_nsec / 1000);
 	return usec;
 }
 
+/* return current time using a nsec unit */
+long gettimensec(){
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/* save latency of request started at 'start' */
+void lat_record(long start){
+	if (nr_lat < NR_REQUESTS)
+		lat[nr_lat++] = gettimensec() - start;
+}
+
+int lat_compare(const void *a, const void *b){
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+/* latency at 'percentile' of sorted lat[] (usec) */
+double lat_percentile(double percentile){
+	int rank = (int)(percentile / 100.0 * nr_lat + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > nr_lat)
+		rank = nr_lat;
+	return lat[rank - 1] / 1000.0;
+}
+
+/* summarize latencies of a finished phase */
+void lat_finish(const char *name){
+	struct lat_result *res = &lat_results[nr_results++];
+
+	qsort(lat, nr_lat, sizeof(long), lat_compare);
+	res->name = name;
+	res->requests = nr_lat;
+	if (nr_lat > 0) {
+		res->p50 = lat_percentile(50);
+		res->p90 = lat_percentile(90);
+		res->p99 = lat_percentile(99);
+		res->p999 = lat_percentile(99.9);
+		res->max = lat[nr_lat - 1] / 1000.0;
+	}
+	nr_lat = 0;
+}
+
 
 /* Create #NUMFILES of files for I/O benchmarking */
 void file_create(){
@@ -109,7 +170,9 @@ void file_write_sequential(){
 
 		// Total written size is FILESIZE
 		for( j = 0; j < FILESIZE; j += req_size){
+			long start = gettimensec();
 			act_size = write(fd, buf, req_size);
+			lat_record(start);
 			if (act_size == -1) {
 				perror("write");
 				exit(1);
@@ -144,7 +207,9 @@ void file_read_sequential(){
 	
 		// Total read size is FILESIZE
 		for ( j = 0; j < FILESIZE; j += req_size ){
+			long start = gettimensec();
 			act_size = read(fd, buf, req_size);
+			lat_record(start);
 			if (act_size == -1) {
 				perror("read");
 				exit(1);
@@ -189,9 +254,11 @@ void file_write_random(){
 			// FILESIZE is devided to the unit of req_size. 
 			// random block number 0 to (FILESIZE/req_size -1)
 			rand_num = rand() % ( (int) (FILESIZE/req_size) );	
-			// Seeking should be the unit of Byte. So (block number * req_size) is used.
-			lseek( fd, req_size * rand_num, SEEK_SET);
-			act_size = write(fd, buf, req_size);
+			// Offset should be the unit of Byte. So (block number * req_size) is used.
+			// pwrite() seeks & writes in one call, only the write is timed.
+			long start = gettimensec();
+			act_size = pwrite(fd, buf, req_size, (off_t)req_size * rand_num);
+			lat_record(start);
 			if (act_size == -1) {
 				perror("write");
 				exit(1);
@@ -229,9 +296,11 @@ void file_read_random(){
 			// FILESIZE is devided to the unit of req_size. 
 			// random block number 0 to (FILESIZE/req_size -1)
 			rand_num = rand() % ( (int) (FILESIZE/req_size) );
-			// Seeking should be the unit of Byte. So (block number * req_size) is used.
-			lseek( fd, req_size * rand_num, SEEK_SET);
-			act_size = read(fd, buf, req_size);
+			// Offset should be the unit of Byte. So (block number * req_size) is used.
+			// pread() seeks & reads in one call, only the read is timed.
+			long start = gettimensec();
+			act_size = pread(fd, buf, req_size, (off_t)req_size * rand_num);
+			lat_record(start);
 			if (act_size == -1) {
 				perror("read");
 				exit(1);
@@ -250,6 +319,7 @@ int main(int argc, char **argv)
 {
 	long creat_time_sequential, write_time_sequential, read_time_sequential, delete_time_sequential, end_time_sequential;
 	long creat_time_random, write_time_random, read_time_random, delete_time_random, end_time_random;
+	int i;
 
 	if (argc != 3) {
 		usage(argv[0]);
@@ -264,10 +334,12 @@ int main(int argc, char **argv)
 
 	write_time_sequential = gettimeusec();	
 	file_write_sequential();
+	lat_finish("Sequential Write");
 
 
 	read_time_sequential = gettimeusec();
 	file_read_sequential();
+	lat_finish("Sequential Read");
 
 	
 	// Random Access Test
@@ -275,10 +347,12 @@ int main(int argc, char **argv)
 
 	write_time_random = gettimeusec();
 	file_write_random();
+	lat_finish("Random Write");
 
 
 	read_time_random = gettimeusec();
 	file_read_random();
+	lat_finish("Random Read");
 
 	
 	delete_time_random = gettimeusec();
@@ -296,6 +370,26 @@ int main(int argc, char **argv)
 	printf("File Delete\t : \t%10ld\n",end_time_random-delete_time_random);
 	printf("Total\t\t : \t%10ld\n",end_time_random - creat_time_sequential);
 
+	// same order as lat_results[]
+	long phase_usec[4] = {
+		read_time_sequential - write_time_sequential,
+		write_time_random - read_time_sequential,
+		read_time_random - write_time_random,
+		delete_time_random - read_time_random,
+	};
+
+	printf("==============  Request Latency (usec)  ===========================================\n");
+	printf("\t\t :       IOPS       MB/s      p50      p90      p99    p99.9      max\n");
+	for (i = 0; i < nr_results; i++) {
+		struct lat_result *res = &lat_results[i];
+		double sec = phase_usec[i] / 1000000.0;
+		printf("%-16s : %10.0f %10.2f %8.1f %8.1f %8.1f %8.1f %8.1f\n", res->name,
+			sec > 0 ? res->requests / sec : 0,
+			// decimal MB, as fsbench reports
+			sec > 0 ? (double)res->requests * req_size / 1e6 / sec : 0,
+			res->p50, res->p90, res->p99, res->p999, res->max);
+	}
+
 	printf("==================================================================================\n");
 
 
@@ -7,11 +7,16 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/semaphore.h>
+#include <linux/rwsem.h>//@ Readers share the list, writers own it
 #include <asm/uaccess.h>
 #include <linux/init.h>
 #include <linux/device.h>
 #include <linux/random.h>//@ For random number generation 
 #include <linux/slab.h>  //@ For kmalloc memory allocation
+#include <linux/vmalloc.h>//@ For the slot array and value index
+#include <linux/hash.h>  //@ For hashing values into the index
+#include <linux/log2.h>  //@ For sizing the index
+#include <linux/sched.h> //@ For cond_resched while building the list
 #include "./linked_list.h"//@ Required structures and functions 
 
 #define DUMMY_MAJOR_NUMBER 250
@@ -33,30 +38,63 @@ struct file_operations dummy_fops = {
 };
 
 char devicename[20];
-struct semaphore mutex;//@ Controls access to the linked list blocks
+struct rw_semaphore list_lock;//@ Controls access to the linked list blocks
 struct semaphore full; //@ Prevents raders' access if the list is empty
 struct semaphore empty;//@ Prevents writers' access if list is full
 static dev_t device_num;   // For device minor number
 static struct cdev my_cdev;//@ Kernel structure to handle the new device
 static struct class *cl;   //@ Pointer to class of the device? 
 
+module_param(list_size, int, 0444);//@ insmod linked_list.ko list_size=1000000
+MODULE_PARM_DESC(list_size, "number of blocks in the list (default 10000)");
+
+static bool debug;//@ insmod linked_list.ko debug=1 to log every read and write
+module_param(debug, bool, 0644);
+MODULE_PARM_DESC(debug, "log every read and write (default 0, the console would serialize them)");
+
+/*@ printk for every read and write, only with debug=1 @*/
+#define dummy_log(fmt, args...) \
+	do { \
+		if(debug) \
+			printk(fmt, ##args); \
+	} while (0)
+
 static int __init dummy_init(void)
 {
 	printk("Dummy Driver : Module Init\n");
 	strcpy(devicename, DUMMY_DEVICE_NAME);
 
+	if(list_size < 1){
+		printk(KERN_ERR "list_size must be at least 1\n");
+		return -EINVAL;
+	}
+
+	/*@ Initialize the semaphores, open()/read() may come as soon as cdev_add() @*/
+	init_rwsem(&list_lock);
+	sema_init(&empty,list_size);
+	sema_init(&full ,0);
+
+	/*@ Create the linked list required structures before the device appears @*/
+	if(dummy_create() < 0){
+		dummy_destroy();
+		return -ENOMEM;
+	}
+
 	// Allocating device region 
 	if(alloc_chrdev_region(&device_num, 0, 1, devicename)){
+		dummy_destroy();
 		return -1;
 	}
 	if((cl = class_create(THIS_MODULE, "chardrv" )) == NULL){
 		unregister_chrdev_region(device_num, 1);
+		dummy_destroy();
 		return -1;
 	}
 	// Device Create == mknod /dev/DUMMY_DEVICE 
 	if(device_create(cl, NULL, device_num, NULL, devicename) == NULL){
 		class_destroy(cl);
 		unregister_chrdev_region(device_num, 1);
+		dummy_destroy();
 		return -1;
 	}
 	// Device Init 
@@ -67,12 +105,6 @@ static int __init dummy_init(void)
 		unregister_chrdev_region(device_num, 1);
 	}
 	
-	/*@ Initialize the semaphores @*/
-	sema_init(&mutex,1);
-	sema_init(&empty,LIST_SIZE);
-	sema_init(&full ,0);
-	
-	dummy_create();//@ Create the linked list required structures
 	return 0;
 }
 
@@ -88,84 +120,89 @@ static void __exit dummy_exit(void)
 
 ssize_t dummy_read(struct file *file, char *buffer, size_t length, loff_t *offset)
 { 
-	int i = 0;
+	int value;
 	int rand_num;
-	int *dummy_buf = (int *)kmalloc(sizeof(int),GFP_KERNEL); 
-	
-	block *read_block = list.head; //@ Initialize the block pointer
+	block *read_block;
 	
 	/*@ Load read value requested from parameter lenght @*/
 	rand_num = length;//@ length is now used to request values
 	
-	down(&full);//@ Sleep if there is zero full blocks
-	down(&mutex);//@ Enter criticla region
-		
-		/*@ Loop until the hold list has been searched @*/
-		while(i < list.cnt){	
-			
-			if(read_block->value == rand_num){
-				
-				*dummy_buf = read_block->value;//@ Copy the value to the dummy	
-				read_block->value = INIT_VAL;//@ Delete the value from the block
-				printk("@ Read HIT\n");
-				goto HIT;//@  The value was found, copy to user the value	
-			}
-			read_block = read_block->next;
-			i++;//@ Save the iteartion number
-		}
-					
+	/*@ Sleep if there is zero full blocks, fail instead if O_NONBLOCK @*/
+	if(file->f_flags & O_NONBLOCK){
+		if(down_trylock(&full))
+			return -EAGAIN;
+	}
+	else
+		down(&full);
+	
+	down_read(&list_lock);//@ Enter critical region, along with other lookups
+	
+		/*@ Look the value up in the index @*/
+		read_block = dummy_find(rand_num);
+	
+	up_read(&list_lock);//@ Exit critical region
+	
+	/*@ Found, delete it from its block alone, unless another reader did @*/
+	if(read_block != NULL){
+		down_write(&list_lock);
+			read_block = dummy_take(rand_num);
+		up_write(&list_lock);
+	}
+	
+	if(read_block != NULL)
+		up(&empty);//@ Signal another block has been emptied
+	else
+		up(&full);//@ A miss empties nothing, the full block stays full
+	
+	if(read_block != NULL){
+		value = rand_num;//@ The value was found, copy to user the value
+		dummy_log("@ Read HIT\n");
+	}
+	else{
 		/*@ Else the value was not located, copy -1 to user @*/
-		*dummy_buf = INIT_VAL;
-		printk(" @ Read MISS\n");
-HIT:		
-		if(copy_to_user(buffer, dummy_buf, sizeof(int))){  
-			kfree(dummy_buf);
-			return -EFAULT;
-		}
-		
-	i = (i>=LIST_SIZE)?-1:i;//@ Block number = -1 if value not found	
-	printk("Dummy Driver : Read Call (block: %d, value: %d)\n",i,*dummy_buf);
+		value = INIT_VAL;
+		dummy_log(" @ Read MISS\n");
+	}
 	
-	up(&mutex);//@ Exit critical region
-	up(&empty);//@ Signal another block has been emptied
+	if(copy_to_user(buffer, &value, sizeof(int)))
+		return -EFAULT;
+	
+	/*@ Block number = -1 if value not found, blocks never move @*/	
+	dummy_log("Dummy Driver : Read Call (block: %d, value: %d)\n",
+		read_block ? read_block->slot : -1, value);
 	
-	kfree(dummy_buf);
 	return sizeof(int);
 }
 
 ssize_t dummy_write(struct file *file, const char *buffer, size_t length, loff_t *offset)
 {
-	int i = 0;
+	int value;
 	int rand_num;
-	int *dummy_buf = (int *)kmalloc(sizeof(int),GFP_KERNEL);
 	
-	block *write_block = list.head;//@ Initialize the block pointer 
-	
-	if(copy_from_user(dummy_buf, buffer, sizeof(int))){//@ Copy user's data to dummy 
-		kfree(dummy_buf);
+	if(copy_from_user(&value, buffer, sizeof(int)))//@ Copy user's data 
 		return -EFAULT;
-	}
 	
-	/*@ Create random number ( 0 ~ LIST_SIZE-1 )@*/
+	/*@ Create random number ( 0 ~ list_size-1 )@*/
 	get_random_bytes(&rand_num,sizeof(int));
-	rand_num = abs(rand_num) % LIST_SIZE;
+	rand_num = (unsigned int)rand_num % list_size;
 		
-	down(&empty);//@ Sleep if there is zero empty blocks
-	down(&mutex);//@ Enter critical region
+	/*@ Sleep if there is zero empty blocks, fail instead if O_NONBLOCK @*/
+	if(file->f_flags & O_NONBLOCK){
+		if(down_trylock(&empty))
+			return -EAGAIN;
+	}
+	else
+		down(&empty);
 	
-		while( i < rand_num){
-			write_block = write_block->next;//@ Trasverse the list until
-			i++;                            //@ the random block is pointed at
-		}
-		
-		write_block->value=*dummy_buf;
+	down_write(&list_lock);//@ Enter critical region, alone
 	
-	printk("Dummy Driver : Write Call (block: %d, value: %d)\n",i,*dummy_buf);
+		dummy_store(list.slots[rand_num], value);//@ The random block, by position
 	
-	up(&mutex);//@ Exit critical region
+	up_write(&list_lock);//@ Exit critical region
 	up(&full);//@ Signal another block has been filled
 	
-	kfree(dummy_buf);
+	dummy_log("Dummy Driver : Write Call (block: %d, value: %d)\n",rand_num,value);
+	
 	return sizeof(int);
 }
 
@@ -1,13 +1,15 @@
 #ifndef _LINKED_LIST_H_
 #define _LINKED_LIST_H_
 
-#define LIST_SIZE 10000 
+#define LIST_SIZE 10000 //@ Default number of blocks, see list_size
 #define INIT_VAL -1
 
 typedef struct mem_block
 {
 	struct mem_block *next;//@ Pointer to next block 
 	int value;            //@ Pointer to the value stored in the block
+	int slot;             //@ Position of the block in the list
+	struct hlist_node node;//@ Entry of the value index, while holding a value
 
 }block;
 	
@@ -15,49 +17,82 @@ typedef struct linked_list
 {
 	int cnt;       //@ Number of blocks in the list
 	block *head;   //@ Address of first block's structure
+	block **slots; //@ Address of every block, by position
+	struct hlist_head *index;//@ Blocks holding a value, hashed by value
+	int index_bits;//@ log2 of the number of index buckets
 
 }linked_list;
 
 linked_list list;//@ Instantization of the linked list register
+int list_size = LIST_SIZE;//@ Number of blocks (module parameter)
+struct kmem_cache *block_cache;//@ Dedicated slab cache of the blocks
 
 /******************************************* 
- @ Creates a linked list of size LIST_SIZE @
+ @ Creates a linked list of size list_size @
+ @ Returns -ENOMEM if out of memory        @
 *******************************************/
-void dummy_create(void)
+int dummy_create(void)
 {
 	block *firstblock = NULL;
+	block *tailblock = NULL;
+	block *newblock = NULL;
+	int i;
+	
+	/*@ Allocate the slot array and the value index (one bucket per block) @*/
+	list.index_bits = ilog2(roundup_pow_of_two(max(list_size, 2)));
+	list.slots = (block **)vmalloc(list_size * sizeof(block *));
+	list.index = (struct hlist_head *)vmalloc(sizeof(struct hlist_head) << list.index_bits);
+	if(list.slots == NULL || list.index == NULL){
+		printk(KERN_ERR "vmalloc error, out of memory\n");
+		return -ENOMEM;
+	}
+	for(i=0; i < (1 << list.index_bits); i++)
+		INIT_HLIST_HEAD(&list.index[i]);
+	
+	/*@ All blocks have the same size, allocate them from their own cache @*/
+	block_cache = kmem_cache_create("linked_list_block", sizeof(block), 0, 0, NULL);
+	if(block_cache == NULL){
+		printk(KERN_ERR "kmem_cache_create error, out of memory\n");
+		return -ENOMEM;
+	}
 	
 	/*@ Create and initialize the head of the linked list @*/	
-	firstblock = (block *)kmalloc(sizeof(block),GFP_KERNEL);
+	firstblock = (block *)kmem_cache_alloc(block_cache,GFP_KERNEL);
+	if(firstblock == NULL){
+		printk(KERN_ERR "kmalloc error, out of memory\n");
+		return -ENOMEM;
+	}
 	firstblock->next = NULL;
 	firstblock->value = INIT_VAL;	
+	firstblock->slot = 0;
 	
 	/*@ Update the head address in the list structure @*/
 	list.head = firstblock;
+	list.slots[0] = firstblock;
 	
-	/*@ Add blocks to the list @*/
-	for(list.cnt=1; list.cnt<LIST_SIZE; list.cnt++){
-		
-		block *newblock = list.head;//@ Direct the pointer to the head
+	/*@ Add blocks to the list, after the tail so each append is O(1) @*/
+	tailblock = firstblock;
+	for(list.cnt=1; list.cnt<list_size; list.cnt++){
 		
-		if(newblock != NULL){//@ If that memory is properly allocated
-			while(newblock->next != NULL)//@ Look for the list's tail
-				newblock = newblock->next;
-		}
 		/*@ Allocate memory for the new tail block @*/	
-		newblock->next = (block *)kmalloc(sizeof(block),GFP_KERNEL);
-		newblock = newblock->next;//@ Redirect the pointer to the new allocation
+		newblock = (block *)kmem_cache_alloc(block_cache,GFP_KERNEL);
 		
-		if(newblock == 0){
-			printk(KERN_ERR "kmalloc error, out of memory\n");
-			return;
+		if(newblock == NULL){
+			printk(KERN_ERR "kmem_cache_alloc error, out of memory\n");
+			return -ENOMEM;
 		}
 		/*@ Initialize the data of the new block  @*/
 		newblock->next = NULL;
 		newblock->value = INIT_VAL;
+		newblock->slot = list.cnt;
+		list.slots[list.cnt] = newblock;//@ Index the block by position
+		
+		tailblock->next = newblock;//@ Link the block after the tail
+		tailblock = newblock;
+		cond_resched();//@ Millions of blocks may take a while
 	}
 	printk("@ Linked list created (list.cnt = %d)\n",list.cnt);	
-	
+	return 0;
 }
 /******************************************** 
  @ Free memory allocated by the linked list @
@@ -71,10 +106,70 @@ void dummy_destroy(void)
 		
 		poorblock = dummyblock;//@ Save the address of the block to delete
 		dummyblock = dummyblock->next;//@ Point to the next block in the list
-		kfree(poorblock);//@ Free the poor block
+		kmem_cache_free(block_cache, poorblock);//@ Free the poor block
 		list.cnt--;
+		cond_resched();
 	}
+	if(block_cache != NULL)
+		kmem_cache_destroy(block_cache);
+	block_cache = NULL;
+	vfree(list.slots);
+	vfree(list.index);
+	list.slots = NULL;
+	list.index = NULL;
 	printk("@ Linked list destroyed (list.cnt = %d)\n",list.cnt);		
 }
 
+/*@ Bucket of the value index for a value @*/
+static inline struct hlist_head *dummy_bucket(int value)
+{
+	return &list.index[hash_32((u32)value, list.index_bits)];
+}
+
+/************************************************* 
+ @ Stores a value in a block, in O(1)            @
+ @ The old value, if any, leaves the value index @
+*************************************************/
+void dummy_store(block *blk, int value)
+{
+	if(blk->value != INIT_VAL)
+		hlist_del(&blk->node);
+	blk->value = value;
+	if(value != INIT_VAL)
+		hlist_add_head(&blk->node, dummy_bucket(value));
+}
+
+/************************************************** 
+ @ Looks up a block holding value, in O(1)        @
+ @ Returns the block, NULL if no block holds value @
+**************************************************/
+block *dummy_find(int value)
+{
+	block *blk;
+	
+	if(value == INIT_VAL)
+		return NULL;
+	
+	hlist_for_each_entry(blk, dummy_bucket(value), node){
+		if(blk->value == value)
+			return blk;
+	}
+	return NULL;
+}
+
+/************************************************** 
+ @ Empties a block holding value, in O(1)         @
+ @ Returns the block, NULL if no block holds value @
+**************************************************/
+block *dummy_take(int value)
+{
+	block *blk = dummy_find(value);
+	
+	if(blk != NULL){
+		hlist_del(&blk->node);
+		blk->value = INIT_VAL;
+	}
+	return blk;
+}
+
 #endif //_LINKED_LIST_H_
\ No newline at end of file
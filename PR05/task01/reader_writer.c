@@ -2,22 +2,44 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <pthread.h>
 #include <time.h>     //@ For system time (random seed)
 
-#define NUMREAD 2			// Number of Readers
-#define NUMWRITE 2			// Number of Writers
+#define NUMREAD 2			// Default number of Readers
+#define NUMWRITE 2			// Default number of Writers
+#define MAXTHREAD 64		// Most readers or writers
+#define CACHELINE 64		// Bytes per cache line
 
 #define DEVICE_NAME "/dev/DUMMY_DEVICE"
 #define NUMLOOP 11
 #define RAND_SPAN 10 //Highest random request value is RAND_SPAN-1
 
+/*@ Usage: reader_writer [readers] [writers] [seconds]
+ @ Without seconds every thread reads or writes NUMLOOP times, printing
+ @ each call. With seconds the device is benchmarked instead: for 1, 2,
+ @ 4, ... up to the given readers, all threads read or write as fast as
+ @ they can for that long and the aggregate ops/sec is reported.
+@*/
+
+/*@ Operations done by one thread, alone in its cache line so that
+ @ threads counting do not slow each other down (false sharing)
+@*/
+typedef struct thrd_ops
+{
+	long ops;
+
+}__attribute__((aligned(CACHELINE))) thrd_ops;
+
 /*@ Stores threads' related info @*/
 typedef struct thrd_data 
 { 
-	int rID [NUMREAD];//@ Array that represents readers' ID numbers
-	int wID [NUMWRITE];//@ Array that represents writers' ID numbers
+	int rID [MAXTHREAD];//@ Array that represents readers' ID numbers
+	int wID [MAXTHREAD];//@ Array that represents writers' ID numbers
+	thrd_ops rops[MAXTHREAD];//@ Reads done by each reader (benchmark)
+	thrd_ops wops[MAXTHREAD];//@ Writes done by each writer (benchmark)
 	int fd;//@ Device file descriptor
+	volatile int stop;//@ Set when the benchmark time is up
 	
 }thrd_data; 
 
@@ -56,43 +78,134 @@ void *read_func(void *arg)
 	pthread_exit(NULL);
 }
 
-int main(void)
+/* Benchmark writer function, counts writes until stopped */
+void *write_bench(void *arg)
 {
-	int i;	
-		
-	pthread_t read_thread[NUMREAD];
-	pthread_t write_thread[NUMWRITE];
-	
-	srand((unsigned)time(NULL));
-	
-	/*@ Initilize threads info @*/
-	if((thrd.fd = open(DEVICE_NAME,O_RDWR)) < 0){
-		printf("open error\n");
-		return -1; 
-	}
-	for(i=0; i<NUMWRITE; i++){
-		thrd.wID[i]=i;
+	int val;
+	int ID = *( (int*)arg );
+	unsigned seed = ID;//@ rand() would serialize the threads on its lock
+
+	while(!thrd.stop){
+		val = rand_r(&seed)%RAND_SPAN;
+		if(write(thrd.fd, &val, sizeof(int)) == sizeof(int))
+			thrd.wops[ID].ops++;
+		else if(errno != EAGAIN)//@ EAGAIN: no empty block, try again
+			break;
 	}
-	for(i=0; i<NUMREAD; i++){
-		thrd.rID[i]=i;
+	pthread_exit(NULL);
+}
+
+/* Benchmark reader function, counts reads (hits & misses) until stopped */
+void *read_bench(void *arg)
+{
+	int val;
+	int ID = *( (int*)arg );
+	unsigned seed = MAXTHREAD + ID;
+
+	while(!thrd.stop){
+		if(read(thrd.fd, &val, rand_r(&seed)%RAND_SPAN) == sizeof(int))
+			thrd.rops[ID].ops++;
+		else if(errno != EAGAIN)//@ EAGAIN: no full block, try again
+			break;
 	}
-	
+	pthread_exit(NULL);
+}
+
+/*@ Runs nread readers & nwrite writers, f_read & f_write, to completion,
+ @ or for seconds if the functions stop on thrd.stop
+@*/
+void run(int nread, int nwrite, int seconds,
+	void *(*f_read)(void *), void *(*f_write)(void *))
+{
+	int i;
+	pthread_t read_thread[MAXTHREAD];
+	pthread_t write_thread[MAXTHREAD];
+
+	thrd.stop = 0;
+
 	/*@ Create threads @*/
-	for(i=0; i<NUMWRITE; i++){
-		pthread_create(&write_thread[i], NULL, write_func, (void *)&thrd.wID[i]);
+	for(i=0; i<nwrite; i++){
+		pthread_create(&write_thread[i], NULL, f_write, (void *)&thrd.wID[i]);
 	}
-	for(i=0; i<NUMREAD; i++){
-		pthread_create(&read_thread[i], NULL, read_func, (void *)&thrd.rID[i]);
+	for(i=0; i<nread; i++){
+		pthread_create(&read_thread[i], NULL, f_read, (void *)&thrd.rID[i]);
 	}
-	
+
+	if(seconds > 0){
+		sleep(seconds);
+		thrd.stop = 1;
+	}
+
 	/*@ Wait for threads to join @*/
-	for(i=0; i<NUMWRITE; i++){
-		pthread_join(write_thread[i],NULL);	
+	for(i=0; i<nwrite; i++){
+		pthread_join(write_thread[i],NULL);
 	}
-	for(i=0; i<NUMREAD; i++){
-		pthread_join(read_thread[i],NULL);	
+	for(i=0; i<nread; i++){
+		pthread_join(read_thread[i],NULL);
 	}
-	
+}
+
+/*@ Aggregate ops/sec for 1, 2, 4, ... nread readers against nwrite writers @*/
+void bench(int nread, int nwrite, int seconds)
+{
+	int i, r;
+	long reads, writes;
+
+	printf("%8s %8s %14s %14s %14s\n","readers","writers","reads/sec","writes/sec","ops/sec");
+	for(r=1; ; r = (r*2 < nread) ? r*2 : nread){
+
+		for(i=0; i<MAXTHREAD; i++){
+			thrd.rops[i].ops = 0;
+			thrd.wops[i].ops = 0;
+		}
+		run(r, nwrite, seconds, read_bench, write_bench);
+
+		reads = writes = 0;
+		for(i=0; i<r; i++)
+			reads += thrd.rops[i].ops;
+		for(i=0; i<nwrite; i++)
+			writes += thrd.wops[i].ops;
+
+		printf("%8d %8d %14.0f %14.0f %14.0f\n", r, nwrite, (double)reads/seconds,
+			(double)writes/seconds, (double)(reads+writes)/seconds);
+
+		if(r == nread)
+			break;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int nread = NUMREAD, nwrite = NUMWRITE, seconds = 0;
+
+	if(argc > 1) nread = atoi(argv[1]);
+	if(argc > 2) nwrite = atoi(argv[2]);
+	if(argc > 3) seconds = atoi(argv[3]);
+	if(nread < 1 || nread > MAXTHREAD || nwrite < 1 || nwrite > MAXTHREAD || seconds < 0){
+		printf("usage: %s [readers 1-%d] [writers 1-%d] [seconds]\n",argv[0],MAXTHREAD,MAXTHREAD);
+		return -1;
+	}
+
+	srand((unsigned)time(NULL));
+
+	/*@ Initilize threads info, the benchmark must not sleep in the device @*/
+	if((thrd.fd = open(DEVICE_NAME, seconds > 0 ? O_RDWR|O_NONBLOCK : O_RDWR)) < 0){
+		printf("open error\n");
+		return -1;
+	}
+	for(i=0; i<nwrite; i++){
+		thrd.wID[i]=i;
+	}
+	for(i=0; i<nread; i++){
+		thrd.rID[i]=i;
+	}
+
+	if(seconds > 0)
+		bench(nread, nwrite, seconds);
+	else
+		run(nread, nwrite, 0, read_func, write_func);
+
 	close(thrd.fd);
 	return 0;
 }